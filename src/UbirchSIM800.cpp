@@ -25,7 +25,6 @@
 #include "UbirchSIM800.h"
 
 #if defined(TEENSYDUINO)
-#define sscanf_P(i, p, ...)    sscanf((i), (p), __VA_ARGS__)
 #define Serial      Serial1
 #endif
 #define println_param(prefix, p) print(F(prefix)); print(F(",\"")); print(p); println(F("\""));
@@ -54,6 +53,201 @@
 #   define DEBUGQLN(...)
 #endif
 
+// URC messages and lookup tables, generated from SIM800_URCS
+#define SIM800_URC_MESSAGE(id, message) static const char _urc_##id[] PROGMEM = message;
+SIM800_URCS(SIM800_URC_MESSAGE)
+#undef SIM800_URC_MESSAGE
+
+#define SIM800_URC_ENTRY(id, message) _urc_##id,
+static const char *const _urc_messages[] PROGMEM = {SIM800_URCS(SIM800_URC_ENTRY)};
+#undef SIM800_URC_ENTRY
+
+#define SIM800_URC_LENGTH(id, message) sizeof(message) - 1,
+static const uint8_t _urc_lengths[] PROGMEM = {SIM800_URCS(SIM800_URC_LENGTH)};
+#undef SIM800_URC_LENGTH
+
+// the only URC a line may be, told apart by the characters where the messages differ,
+// the whole message is compared after that (line is terminated, len is at least 3)
+static uint8_t urc_candidate(const char *line, size_t len) {
+  switch (line[0]) {
+    case '+':
+      switch (line[1]) {
+        case 'C':
+          switch (line[2]) {
+            case 'I': return line[3] == 'P' ? SIM800_URC_CIPRXGET : SIM800_URC_CIEV;
+            case 'P': return SIM800_URC_CPIN_READY;
+            case 'R': return SIM800_URC_CREG;
+            case 'T': return SIM800_URC_CTZV;
+            default: return SIM800_URC_COUNT;
+          }
+        case 'F': return SIM800_URC_FTPGET;
+        case 'P': return SIM800_URC_PDP_DEACT;
+        case 'S': return SIM800_URC_SAPBR_DEACT;
+        default: return SIM800_URC_COUNT;
+      }
+    case '*': return line[3] == 'N' ? SIM800_URC_PSNWID : SIM800_URC_PSUTTZ;
+    case 'C': return SIM800_URC_CALL_READY;
+    case 'D': return line[1] == 'S' ? SIM800_URC_DST : SIM800_URC_DATA_ACCEPT;
+    case 'N': return SIM800_URC_NORMAL_POWER_DOWN;
+    case 'O': return len > 13 && line[13] == 'P' ? SIM800_URC_OVER_VOLTAGE_POWER_DOWN : SIM800_URC_OVER_VOLTAGE_WARNING;
+    case 'R': return SIM800_URC_RDY;
+    case 'S': return SIM800_URC_SMS_READY;
+    case 'U': return len > 14 && line[14] == 'P' ? SIM800_URC_UNDER_VOLTAGE_POWER_DOWN : SIM800_URC_UNDER_VOLTAGE_WARNING;
+    default: return SIM800_URC_COUNT;
+  }
+}
+
+// the URC the line is, SIM800_URC_COUNT if it is none (line is terminated)
+static uint8_t urc_match(const char *line, size_t len) {
+  if (len < 3) return SIM800_URC_COUNT;
+
+  const uint8_t i = urc_candidate(line, len);
+  if (i == SIM800_URC_COUNT) return i;
+
+#ifdef __AVR__
+  const char *urc = (const char *) pgm_read_word(&_urc_messages[i]);
+#else
+  const char *urc = _urc_messages[i];
+#endif
+  uint8_t urc_len = pgm_read_byte(&_urc_lengths[i]);
+  if (len < urc_len || strncmp_P(line, urc, urc_len)) return SIM800_URC_COUNT;
+  return i;
+}
+
+// baud rates the SIM800 supports with a fixed rate (AT+IPR), fastest first
+static const uint32_t _baud_rates[] PROGMEM = {460800, 230400, 115200, 57600, 38400, 19200, 9600};
+
+#ifndef SIM800_NO_ARENA
+// transfer buffer used unless the application provides one with setBuffer()
+static char _arena[SIM800_HTTP_CHUNK];
+#endif
+
+// typed parsers for the fields of a response, each one advances p past what it
+// consumed and returns false (leaving the value alone) if the field is missing
+
+// an unsigned number (decimal, or hex for cell ids)
+static bool scan_number(const char *&p, uint32_t &value, uint8_t base = 10) {
+  uint32_t v = 0;
+  const char *start = p;
+  for (;; p++) {
+    uint8_t digit;
+    if (*p >= '0' && *p <= '9') digit = (uint8_t) (*p - '0');
+    else if (base == 16 && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'f') digit = (uint8_t) ((*p | 0x20) - 'a' + 10);
+    else break;
+    v = v * base + digit;
+  }
+  if (p == start) return false;
+  value = v;
+  return true;
+}
+
+static bool scan_number(const char *&p, uint16_t &value, uint8_t base = 10) {
+  uint32_t v;
+  if (!scan_number(p, v, base) || v > 0xffff) return false;
+  value = (uint16_t) v;
+  return true;
+}
+
+static bool scan_char(const char *&p, char c) {
+  if (*p != c) return false;
+  p++;
+  return true;
+}
+
+// ",<number>", the usual way the fields of a response continue
+static bool scan_next(const char *&p, uint32_t &value) {
+  return scan_char(p, ',') && scan_number(p, value);
+}
+
+static bool scan_next(const char *&p, uint16_t &value) {
+  return scan_char(p, ',') && scan_number(p, value);
+}
+
+// copy the text up to the delimiter, the other one if given, or the end of the line,
+// cut to the size of the destination
+static bool scan_field(const char *&p, char *dst, size_t size, char delimiter, char other = '\0') {
+  size_t i = 0;
+  for (; *p && *p != delimiter && *p != other; p++) if (i < size - 1) dst[i++] = *p;
+  dst[i] = '\0';
+  return i > 0;
+}
+
+// CRC-32 (as zlib crc32()), bitwise to keep the flash footprint small
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length) {
+  crc = ~crc;
+  while (length--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+  }
+  return ~crc;
+}
+
+// adds the time spent in a scope to a counter
+struct SIM800Timer {
+  uint32_t &total;
+  unsigned long started;
+
+  SIM800Timer(uint32_t &total) : total(total), started(millis()) { }
+
+  ~SIM800Timer() { total += millis() - started; }
+};
+
+// counts what a writer produces
+class SIM800Counter : public Print {
+public:
+  uint32_t count = 0;
+
+  virtual size_t write(uint8_t) {
+    count++;
+    return 1;
+  }
+
+  virtual size_t write(const uint8_t *, size_t size) {
+    count += size;
+    return size;
+  }
+};
+
+// splits what a writer produces into blocks announced with AT+CIPSEND
+class SIM800Sender : public Print {
+public:
+  SIM800Sender(UbirchSIM800 &sim800, uint8_t link, uint32_t size) : _sim800(sim800), _link(link), _remaining(size) { }
+
+  bool ok = true;
+  size_t sent = 0;
+
+  virtual size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
+
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t done = 0;
+    while (ok && done < size && _remaining) {
+      if (!_block) {
+        _block = (size_t) min(_remaining, (uint32_t) SIM800_TX_CHUNK);
+        ok = _sim800.send_prompt(_link, _block);
+        if (!ok) break;
+      }
+      size_t n = min(size - done, _block);
+      _sim800._serial.write(buffer + done, n);
+      _sim800._stats.tcp_tx += n;
+      // counted right away, the window check of the next block depends on it
+      _sim800._tx_sent[_link] += n;
+      done += n;
+      _block -= n;
+      _remaining -= n;
+      sent += n;
+    }
+    return done;
+  }
+
+private:
+  UbirchSIM800 &_sim800;
+  uint8_t _link;
+  uint32_t _remaining;
+  size_t _block = 0;
+};
+
 UbirchSIM800::UbirchSIM800() {
 }
 
@@ -62,6 +256,8 @@ bool UbirchSIM800::reset(bool fona) {
 }
 
 bool UbirchSIM800::reset(uint32_t serialSpeed, bool fona) {
+  SIM800Timer timer(_stats.reset_time);
+  _serialSpeed = serialSpeed;
   _serial.begin(serialSpeed);
 
   pinMode(SIM800_RST, OUTPUT);
@@ -71,26 +267,113 @@ bool UbirchSIM800::reset(uint32_t serialSpeed, bool fona) {
   delay(100);
   digitalWrite(SIM800_RST, HIGH);
 
-  delay(7000);
-
   // RST high keeps the chip in reset without a diode, so put to low
   if (!fona) digitalWrite(SIM800_RST, LOW);
 
-  while (_serial.available()) _serial.read();
+  return boot();
+}
+
+bool UbirchSIM800::boot() {
+  unsigned long started = millis();
+  _http_init = false;
+  _ip_up = false;
+  _links = _links_rx = 0;
+  _creg = 0;
+  _bearer_up = false;
+  _bearer_configured = false;
+
+  rx_clear();
+
+  // probe until the chip answers, the first AT also lets it detect the baud rate,
+  // boot messages (RDY, +CPIN: READY, Call Ready, SMS Ready) are taken care of as URCs
+  bool ready;
+  do ready = expect_AT_OK(F(""), SIM800_PROBE_TIMEOUT);
+  while (!ready && millis() - started < SIM800_BOOT_TIMEOUT);
+  // the chip may have been set to a fixed rate (AT+IPR, AT&W) we do not know about
+  if (!ready) detect_baud();
 
-  expect_AT_OK(F(""));
-  expect_AT_OK(F(""));
-  expect_AT_OK(F(""));
   bool ok = expect_AT_OK(F("E0"));
 
   expect_AT_OK(F("+IFC=0,0")); // No hardware flow control
   expect_AT_OK(F("+CIURC=0")); // No "Call Ready"
 
-  while (_serial.available()) _serial.read();
+  rx_clear();
 
+  _boot_time = millis() - started;
+#if !defined(NDEBUG) && defined(DEBUG_PROGRESS)
+  PRINT("!!! SIM800 ready after ");
+  DEBUG(_boot_time);
+  PRINTLN("ms");
+#endif
   return ok;
 }
 
+uint32_t UbirchSIM800::negotiateBaud(uint32_t max, bool persist) {
+  for (uint8_t i = 0; i < sizeof(_baud_rates) / sizeof(_baud_rates[0]); i++) {
+    uint32_t rate = pgm_read_dword(&_baud_rates[i]);
+    if (rate > max) continue;
+    if (rate <= _serialSpeed) break;
+    if (setBaud(rate)) break;
+  }
+
+  if (persist && !expect_AT_OK(F("&W"))) {
+    PRINTLN("!!! SIM800 failed to store baud rate");
+  }
+  return _serialSpeed;
+}
+
+bool UbirchSIM800::setBaud(uint32_t rate) {
+  uint32_t previous = _serialSpeed;
+
+  print(F("AT+IPR="));
+  println(rate);
+  if (!expect_OK()) return false;
+
+  _serial.flush();
+  _serial.begin(rate);
+  _serialSpeed = rate;
+  if (verify_baud()) return true;
+
+  // the chip may still understand us at the new rate, switch it back and fall back
+  print(F("AT+IPR="));
+  println(previous);
+  expect_OK();
+  _serial.flush();
+  _serial.begin(previous);
+  _serialSpeed = previous;
+  verify_baud();
+  return false;
+}
+
+bool UbirchSIM800::verify_baud() {
+  // a framing error garbles the echoed rate
+  for (uint8_t i = 0; i < 3; i++) {
+    println(F("AT+IPR?"));
+    uint32_t rate = 0;
+    if (expect_numbers(F("+IPR: "), rate, SIM800_PROBE_TIMEOUT) && rate == _serialSpeed && expect_OK()) return true;
+  }
+  return false;
+}
+
+bool UbirchSIM800::detect_baud() {
+  uint32_t configured = _serialSpeed;
+  for (uint8_t i = 0; i < sizeof(_baud_rates) / sizeof(_baud_rates[0]); i++) {
+    uint32_t rate = pgm_read_dword(&_baud_rates[i]);
+    if (rate > SIM800_BAUD_MAX || rate == configured) continue;
+    _serial.begin(rate);
+    if (expect_AT_OK(F(""), SIM800_PROBE_TIMEOUT) || expect_AT_OK(F(""), SIM800_PROBE_TIMEOUT)) {
+      _serialSpeed = rate;
+      return true;
+    }
+  }
+  _serial.begin(configured);
+  return false;
+}
+
+uint32_t UbirchSIM800::boot_time() {
+  return _boot_time;
+}
+
 void UbirchSIM800::setAPN(const __FlashStringHelper *apn, const __FlashStringHelper *user,
                           const __FlashStringHelper *pass) {
   _apn = apn;
@@ -108,78 +391,100 @@ bool UbirchSIM800::unlock(const __FlashStringHelper *pin) {
 bool UbirchSIM800::time(char *date, char *time, char *tz) {
   println(F("AT+CCLK?"));
 
-  return expect_scan(F("+CCLK: \"%8s,%8s%3s\""), date, time, tz) == 3;
+  // +CCLK: "yy/MM/dd,hh:mm:ss+zz", the time zone may be negative
+  const char *p = expect_prefix(F("+CCLK: \""));
+  bool ok = p && scan_field(p, date, 9, ',') && scan_char(p, ',')
+            && scan_field(p, time, 9, '+', '-') && (*p == '+' || *p == '-') && scan_field(p, tz, 4, '"');
+  return expect_OK() && ok;
 }
 
 bool UbirchSIM800::IMEI(char *imei) {
   println(F("AT+GSN"));
-  expect_scan(F("%s"), imei);
+  const char *p = expect_prefix(F(""));
+  if (p) scan_field(p, imei, 16, ' ');
   return expect_OK();
 }
 
 bool UbirchSIM800::battery(uint16_t &bat_status, uint16_t &bat_percent, uint16_t &bat_voltage) {
   println(F("AT+CBC"));
-  if(!expect_scan(F("+CBC: %d,%d,%d"), &bat_status, &bat_percent, &bat_voltage)) {
+  const char *p = expect_prefix(F("+CBC: "));
+  if (!p || !scan_number(p, bat_status) || !scan_next(p, bat_percent) || !scan_next(p, bat_voltage)) {
     Serial.println(F("BAT status lookup failed"));
   }
   return expect_OK();
 }
 
-bool UbirchSIM800::location(char *&lat, char *&lon, char *&date, char *&time) {
-  uint16_t loc_status;
-  char reply[64];
+bool UbirchSIM800::location(sim800_location_t &location) {
+  uint16_t loc_status = 0xffff;
+  memset(&location, 0, sizeof(location));
   println(F("AT+CIPGSMLOC=1,1"));
-  if (!expect_scan(F("+CIPGSMLOC: %d,%s"), &loc_status, reply, 60000)) {
+  // +CIPGSMLOC: <status>,<lon>,<lat>,<date>,<time>
+  const char *p = expect_prefix(F("+CIPGSMLOC: "), 60000);
+  if (!p || !scan_number(p, loc_status)) {
     Serial.println(F("GPS lookup failed"));
   } else {
-    lon = strdup(strtok(reply, ","));
-    lat = strdup(strtok(NULL, ","));
-    date = strdup(strtok(NULL, ","));
-    time = strdup(strtok(NULL, ","));
+    if (scan_char(p, ',')) scan_field(p, location.lon, sizeof(location.lon), ',');
+    if (scan_char(p, ',')) scan_field(p, location.lat, sizeof(location.lat), ',');
+    if (scan_char(p, ',')) scan_field(p, location.date, sizeof(location.date), ',');
+    if (scan_char(p, ',')) scan_field(p, location.time, sizeof(location.time), ',');
   }
-  return expect_OK() && loc_status == 0 && lat && lon;
+  return expect_OK() && loc_status == 0 && *location.lat && *location.lon;
 }
 
 bool UbirchSIM800::wakeup() {
   PRINTLN("!!! SIM800 wakeup");
+  _serial.begin(_serialSpeed);
 
-  expect_AT_OK(F(""));
   // check if the chip is already awake, otherwise start wakeup
-  if (!expect_AT_OK(F(""), 5000)) {
-    PRINTLN("!!! SIM800 using PWRKEY wakeup procedure");
-    pinMode(SIM800_KEY, OUTPUT);
-    pinMode(SIM800_PS, INPUT);
-    do {
-      digitalWrite(SIM800_KEY, HIGH);
-      delay(10);
-      digitalWrite(SIM800_KEY, LOW);
-      delay(1100);
-      digitalWrite(SIM800_KEY, HIGH);
-      delay(2000);
-    } while (digitalRead(SIM800_PS) == LOW);
-    // make pin unused (do not leak)
-    pinMode(SIM800_KEY, INPUT_PULLUP);
-    PRINTLN("!!! SIM800 ok");
-  } else {
+  bool awake = false;
+  for (uint8_t i = 0; i < 3 && !awake; i++) awake = expect_AT_OK(F(""), SIM800_PROBE_TIMEOUT);
+  // after an MCU reset the chip may still run at a rate stored with AT&W, search it
+  // before the PWRKEY pulse, which would switch off a chip that is running fine
+  if (!awake) awake = detect_baud();
+  if (awake) {
     PRINTLN("!!! SIM800 already awake");
+    return reset();
   }
 
-  return reset();
+  SIM800Timer timer(_stats.reset_time);
+  PRINTLN("!!! SIM800 using PWRKEY wakeup procedure");
+  unsigned long started = millis();
+  pinMode(SIM800_KEY, OUTPUT);
+  pinMode(SIM800_PS, INPUT);
+  do {
+    digitalWrite(SIM800_KEY, HIGH);
+    delay(10);
+    digitalWrite(SIM800_KEY, LOW);
+    sleep(1100);
+    digitalWrite(SIM800_KEY, HIGH);
+    // the status pin goes high as soon as the chip is powered on
+    unsigned long pulsed = millis();
+    while (digitalRead(SIM800_PS) == LOW && millis() - pulsed < 2000) idle();
+  } while (digitalRead(SIM800_PS) == LOW && millis() - started < SIM800_BOOT_TIMEOUT);
+  // make pin unused (do not leak)
+  pinMode(SIM800_KEY, INPUT_PULLUP);
+  PRINTLN("!!! SIM800 ok");
+
+  // the chip just powered on, no need to reset it again
+  bool ok = boot();
+  _boot_time = millis() - started;
+  return ok;
 }
 
 bool UbirchSIM800::shutdown() {
   PRINTLN("!!! SIM800 shutdown");
 
   disableGPRS();
+  urc_status = 0xff;
   expect_AT_OK(F("+CPOWD=1"));
   expect(F("NORMAL POWER DOWN"), 5000);
 
-  if (urc_status != 12 && digitalRead(SIM800_PS) == HIGH) {
+  if (urc_status != SIM800_URC_NORMAL_POWER_DOWN && digitalRead(SIM800_PS) == HIGH) {
     PRINTLN("!!! SIM800 shutdown using PWRKEY");
     pinMode(SIM800_KEY, OUTPUT);
     pinMode(SIM800_PS, INPUT);
     digitalWrite(SIM800_KEY, LOW);
-    for (uint8_t s = 30; s > 0 && digitalRead(SIM800_PS) != LOW; --s) delay(1000);
+    for (uint8_t s = 30; s > 0 && digitalRead(SIM800_PS) != LOW; --s) sleep(1000);
     digitalWrite(SIM800_KEY, HIGH);
     pinMode(SIM800_KEY, INPUT);
     pinMode(SIM800_KEY, INPUT_PULLUP);
@@ -189,14 +494,20 @@ bool UbirchSIM800::shutdown() {
 }
 
 bool UbirchSIM800::registerNetwork(uint16_t timeout) {
+  SIM800Timer timer(_stats.register_time);
   PRINTLN("!!! SIM800 waiting for network registration");
   expect_AT_OK(F(""));
-  while (timeout -= 1000) {
-    unsigned short int n = 0;
+  // report registration changes including location area and cell
+  expect_AT_OK(F("+CREG=2"));
+
+  unsigned long started = millis();
+  uint16_t backoff = SIM800_CREG_BACKOFF;
+  for (;;) {
     println(F("AT+CREG?"));
-    expect_scan(F("+CREG: 0,%hu"), &n);
+    // the answer is picked up as URC by handle_urc()
+    expect_OK();
 #if !defined(NDEBUG) && defined(DEBUG_PROGRESS)
-    switch (n) {
+    switch (_creg) {
       case 0:
         PRINT("_");
             break;
@@ -216,96 +527,122 @@ bool UbirchSIM800::registerNetwork(uint16_t timeout) {
         PRINT("R");
             break;
       default:
-        DEBUG(n);
+        DEBUG(_creg);
             break;
     }
 #endif
-    if ((n == 1 || n == 5)) {
+    // wait for the chip to report a change, ask again after the backoff time
+    unsigned long asked = millis();
+    while (!registered() && millis() - asked < backoff && millis() - started < timeout) {
+      poll_urc();
+      idle();
+    }
+    if (registered()) {
 #if !defined(NDEBUG) && defined(DEBUG_PROGRESS)
       PRINTLN("");
 #endif
       return true;
     }
-    delay(1000);
+    if (millis() - started >= timeout) return false;
+    if (backoff < SIM800_CREG_BACKOFF_MAX) backoff *= 2;
   }
-  return false;
+}
+
+bool UbirchSIM800::registered() {
+  return _creg == 1 || _creg == 5;
+}
+
+void UbirchSIM800::onRegistration(sim800_registration_handler_t handler) {
+  _creg_handler = handler;
 }
 
 bool UbirchSIM800::enableGPRS(uint16_t timeout) {
-  expect_AT(F("+CIPSHUT"), F("SHUT OK"), 5000);
-  expect_AT_OK(F("+CIPMUX=1")); // enable multiplex mode
-  expect_AT_OK(F("+CIPRXGET=1")); // we will receive manually
+  SIM800Timer timer(_stats.gprs_time);
+  // the bearer may still be up from before, the TCP/IP connection is left alone
+  if (bearer_up()) return true;
 
-  bool attached = false;
-  while (!attached && timeout > 0) {
+  unsigned long started = millis();
+  bool attached = gprs_attached();
+  while (!attached) {
     attached = expect_AT_OK(F("+CGATT=1"), 10000);
-    delay(1000);
-    timeout -= 1000;
+    if (attached) break;
+    if (millis() - started >= timeout) return false;
+    sleep(1000);
   }
-  if (!attached) return false;
 
-  if (!expect_AT_OK(F("+SAPBR=3,1,\"CONTYPE\",\"GPRS\""), 10000)) return false;
+  // the bearer profile stays configured until the chip is reset
+  if (!_bearer_configured) {
+    if (!expect_AT_OK(F("+SAPBR=3,1,\"CONTYPE\",\"GPRS\""), 10000)) return false;
 
-  // set bearer profile access point name
-  if (_apn) {
-    print(F("AT+SAPBR=3,1,\"APN\",\""));
-    print(_apn);
-    println(F("\""));
-    if (!expect_OK()) return false;
-
-    if (_user) {
-      print(F("AT+SAPBR=3,1,\"USER\",\""));
-      print(_user);
-      println(F("\""));
-      if (!expect_OK()) return false;
-    }
-    if (_pass) {
-      print(F("AT+SAPBR=3,1,\"PWD\",\""));
-      print(_pass);
+    // set bearer profile access point name
+    if (_apn) {
+      print(F("AT+SAPBR=3,1,\"APN\",\""));
+      print(_apn);
       println(F("\""));
       if (!expect_OK()) return false;
+
+      if (_user) {
+        print(F("AT+SAPBR=3,1,\"USER\",\""));
+        print(_user);
+        println(F("\""));
+        if (!expect_OK()) return false;
+      }
+      if (_pass) {
+        print(F("AT+SAPBR=3,1,\"PWD\",\""));
+        print(_pass);
+        println(F("\""));
+        if (!expect_OK()) return false;
+      }
     }
+    _bearer_configured = true;
   }
 
-  // open GPRS context
-  expect_AT_OK(F("+SAPBR=1,1"), 30000);
+  // open GPRS context, fails if it is open already
+  if (!expect_AT_OK(F("+SAPBR=1,1"), 30000)) return bearer_up();
 
-  do {
-    println(F("AT+CGATT?"));
-    attached = expect(F("+CGATT: 1"));
-    delay(1);
-  } while (--timeout && !attached);
+  _bearer_up = true;
+  return true;
+}
+
+bool UbirchSIM800::bearer_up() {
+  // +SAPBR: <cid>,<status>,"<ip>" (0 = connecting, 1 = connected, 2 = closing, 3 = closed)
+  println(F("AT+SAPBR=2,1"));
+  uint32_t cid, status = 3;
+  if (!expect_numbers(F("+SAPBR: "), cid, status) || !expect_OK()) status = 3;
 
-  return attached;
+  _bearer_up = status == 1;
+  return _bearer_up;
+}
+
+bool UbirchSIM800::gprs_attached() {
+  println(F("AT+CGATT?"));
+  uint32_t attached = 0;
+  if (!expect_numbers(F("+CGATT: "), attached)) return false;
+  return expect_OK() && attached == 1;
 }
 
 bool UbirchSIM800::disableGPRS() {
+  HTTP_end();
   expect_AT(F("+CIPSHUT"), F("SHUT OK"));
+  _ip_up = false;
+  _bearer_up = false;
+  _links = _links_rx = 0;
   if (!expect_AT_OK(F("+SAPBR=0,1"), 30000)) return false;
 
   return expect_AT_OK(F("+CGATT=0"));
 }
 
 unsigned short int UbirchSIM800::HTTP_get(const char *url, unsigned long int &length) {
-  expect_AT_OK(F("+HTTPTERM"));
-  delay(100);
-
-  if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
-  if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
-  if (!expect_AT_OK(F("+HTTPPARA=\"UA\",\"UBIRCH#1 r0.1\""))) return 1102;
-  if (!expect_AT_OK(F("+HTTPPARA=\"REDIR\",1"))) return 1103;
-  println_param("AT+HTTPPARA=\"URL\"", url);
-  if (!expect_OK()) return 1110;
+  unsigned short int error = HTTP_session(url);
+  if (error) return error;
 
-  if (!expect_AT_OK(F("+HTTPACTION=0"))) return 1004;
-
-  unsigned short int status;
-  expect_scan(F("+HTTPACTION: 0,%hu,%lu"), &status, &length, 60000);
-
-  return status;
+  return HTTP_action(0, length);
 }
 
 unsigned short int UbirchSIM800::HTTP_get(const char *url, unsigned long int &length, STREAM &file) {
+  size_t chunk;
+  if (!transfer_buffer(chunk)) return 1006;
+
   unsigned short int status = HTTP_get(url, length);
   PRINT("HTTP STATUS: ");
   DEBUGLN(status);
@@ -313,39 +650,87 @@ unsigned short int UbirchSIM800::HTTP_get(const char *url, unsigned long int &le
   DEBUGLN(length);
 
   if (length == 0) return status;
-
-  char *buffer = (char *) malloc(SIM800_BUFSIZE);
-  uint32_t pos = 0;
-  do {
-    size_t r = HTTP_read(buffer, pos, SIM800_BUFSIZE);
-#if !defined(NDEBUG) && defined(DEBUG_PROGRESS)
-    if ((pos % 10240) == 0) {
-      PRINT(" ");
-      DEBUGLN(pos);
-    } else if (pos % (1024) == 0) { PRINT("<"); }
-#endif
-    pos += r;
-    file.write(buffer, r);
-  } while (pos < length);
-  free(buffer);
-  PRINTLN("");
+  if (HTTP_copy(file, 0, length) < length) return 1007;
 
   return status;
 }
 
+unsigned short int UbirchSIM800::HTTP_download(const char *url, sim800_download_t &progress, STREAM &file,
+                                               sim800_download_handler_t handler, void *ctx, uint32_t range) {
+  size_t chunk;
+  if (!transfer_buffer(chunk)) return 1006;
+
+  unsigned short int status = 0;
+  uint8_t retries = SIM800_HTTP_RETRIES;
+  while (!progress.size || progress.offset < progress.size) {
+    uint32_t start = progress.offset;
+    uint32_t last = start + range - 1;
+    if (progress.size && last >= progress.size) last = progress.size - 1;
+
+    unsigned long int length = 0;
+    status = HTTP_session(url);
+    if (!status) {
+      print(F("AT+HTTPPARA=\"USERDATA\",\"Range: bytes="));
+      print(start);
+      print(F("-"));
+      print(last);
+      println(F("\""));
+      status = expect_OK() ? HTTP_action(0, length) : HTTP_abort(1111);
+    }
+
+    if (status == 416 && start && !progress.size) {
+      // the previous range ended exactly at the end of the file
+      progress.size = start;
+      break;
+    }
+    if (status == 200 || status == 206) {
+      // a server that ignores the range sends the whole file, it is read from the offset on
+      uint32_t skip = status == 200 ? start : 0;
+      uint32_t wanted = length > skip ? length - skip : 0;
+      progress.offset += HTTP_copy(file, skip, wanted, &progress.crc);
+      if (progress.offset - start == wanted) {
+        if (status == 200 || length < last - start + 1) progress.size = progress.offset;
+        if (handler) handler(progress, ctx);
+        retries = SIM800_HTTP_RETRIES;
+        continue;
+      }
+      status = 1007;
+    } else if (status >= 400 && status < 600) {
+      // the server refused, trying again does not help
+      break;
+    }
+
+    // the transfer broke off, bring the connection back up and continue where it stopped
+    if (progress.offset != start) {
+      if (handler) handler(progress, ctx);
+      retries = SIM800_HTTP_RETRIES;
+    } else if (!retries--) {
+      break;
+    }
+    HTTP_end();
+    enableGPRS();
+  }
+
+  // the range must not stick to the following requests
+  if (_http_init) expect_AT_OK(F("+HTTPPARA=\"USERDATA\",\"\""));
+  return progress.size && progress.offset == progress.size ? 200 : status;
+}
+
 size_t UbirchSIM800::HTTP_read(char *buffer, uint32_t start, size_t length) {
   print(F("AT+HTTPREAD="));
   print(start);
   print(F(","));
   println((uint32_t) length);
 
-  unsigned long int available;
-  expect_scan(F("+HTTPREAD: %lu"), &available);
+  uint32_t available;
+  if (!expect_numbers(F("+HTTPREAD: "), available)) return 0;
 #ifdef DEBUG_PACKETS
   PRINT("~~~ PACKET: ");
   DEBUGLN(available);
 #endif
-  size_t idx = read(buffer, (size_t) available);
+  size_t idx = read(buffer, (size_t) min(available, (uint32_t) length));
+  _stats.http_rx += idx;
+  _stats.http_reads++;
   if (!expect_OK()) return 0;
 #ifdef DEBUG_PACKETS
   PRINT("~~~ DONE: ");
@@ -355,278 +740,969 @@ size_t UbirchSIM800::HTTP_read(char *buffer, uint32_t start, size_t length) {
 }
 
 unsigned short int UbirchSIM800::HTTP_post(const char *url, unsigned long int &length) {
-  expect_AT_OK(F("+HTTPTERM"));
-  delay(100);
-
-  if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
-  if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
-  if (!expect_AT_OK(F("+HTTPPARA=\"UA\",\"UBIRCH#1\""))) return 1102;
-  if (!expect_AT_OK(F("+HTTPPARA=\"REDIR\",1"))) return 1103;
-  println_param("AT+HTTPPARA=\"URL\"", url);
-  if (!expect_OK()) return 1110;
+  unsigned short int error = HTTP_session(url);
+  if (error) return error;
 
-  if (!expect_AT_OK(F("+HTTPACTION=1"))) return 1001;
-
-  unsigned short int status;
-  expect_scan(F("+HTTPACTION: 0,%hu,%lu"), &status, &length, 60000);
-
-  return status;
+  return HTTP_action(1, length);
 }
 
 unsigned short int UbirchSIM800::HTTP_post(const char *url, unsigned long int &length, char *buffer, uint32_t size) {
-  expect_AT_OK(F("+HTTPTERM"));
-  delay(100);
-
   length = 0;
 
-  if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
-  if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
-  if (!expect_AT_OK(F("+HTTPPARA=\"UA\",\"UBIRCH#1\""))) return 1102;
-  if (!expect_AT_OK(F("+HTTPPARA=\"REDIR\",1"))) return 1103;
-  println_param("AT+HTTPPARA=\"URL\"", url);
-  if (!expect_OK()) return 1110;
+  unsigned short int error = HTTP_session(url);
+  if (error) return error;
 
-  print(F("AT+HTTPDATA="));
-  print(size);
-  print(F(","));
-  println((uint32_t) 120000);
-
-  if (!expect(F("DOWNLOAD"))) return 0;
+  if (!HTTP_data(size)) return 0;
 #ifdef DEBUG_PACKETS
   PRINT("~~~ '");
   DEBUG(buffer);
   PRINTLN("'");
 #endif
   _serial.write(buffer, size);
+  _stats.http_tx += size;
 
   if (!expect_OK(5000)) return 1005;
 
-  if (!expect_AT_OK(F("+HTTPACTION=1"))) return 1004;
+  return HTTP_action(1, length);
+}
 
-  // wait for the action to be completed, give it 5s for each try
-  uint16_t status;
-  while (!expect_scan(F("+HTTPACTION: 1,%hu,%lu"), &status, &length, 5000));
+unsigned short int UbirchSIM800::HTTP_post(const char *url, unsigned long int &length, sim800_writer_t writer, void *ctx) {
+  length = 0;
 
-  return status;
-}
+  SIM800Counter counter;
+  writer(counter, ctx);
 
+  unsigned short int error = HTTP_session(url);
+  if (error) return error;
 
-unsigned short int UbirchSIM800::HTTP_post(const char *url, unsigned long int &length, STREAM &file, uint32_t size) {
-  expect_AT_OK(F("+HTTPTERM"));
-  delay(100);
+  if (!HTTP_data(counter.count)) return 0;
+  writer(_serial, ctx);
+  _stats.http_tx += counter.count;
 
-  if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
-  if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return 1101;
-  if (!expect_AT_OK(F("+HTTPPARA=\"UA\",\"UBIRCH#1\""))) return 1102;
-  if (!expect_AT_OK(F("+HTTPPARA=\"REDIR\",1"))) return 1103;
-  println_param("AT+HTTPPARA=\"URL\"", url);
-  if (!expect_OK()) return 1110;
+  if (!expect_OK(5000)) return 1005;
 
-  print(F("AT+HTTPDATA="));
-  print(size);
-  print(F(","));
-  println((uint32_t) 120000);
+  return HTTP_action(1, length);
+}
 
-  if (!expect(F("DOWNLOAD"))) return 0;
+unsigned short int UbirchSIM800::HTTP_post(const char *url, unsigned long int &length, STREAM &file, uint32_t size) {
+  size_t block;
+  char *buffer = transfer_buffer(block);
+  if (!buffer) return 1006;
 
-  uint8_t *buffer = (uint8_t *) malloc(SIM800_BUFSIZE);
-  uint32_t pos = 0, r = 0;
+  unsigned short int error = HTTP_session(url);
+  if (error) return error;
 
-  do {
-    for (r = 0; r < SIM800_BUFSIZE; r++) {
+  if (!HTTP_data(size)) return 0;
+
+  unsigned long started = millis();
+  uint32_t pos = 0;
+  while (pos < size) {
+    size_t n = 0, max = (size_t) min((uint32_t) block, size - pos);
+    while (n < max) {
       int c = file.read();
       if (c == -1) break;
-      _serial.write((uint8_t) c);
+      buffer[n++] = (char) c;
     }
+    if (!n) break;
 
-    if (r < SIM800_BUFSIZE) {
+    // the hardware serial queues the block and sends it while we read the next one
+    _serial.write(buffer, n);
 #if !defined(NDEBUG) && defined(DEBUG_PROGRESS)
-      PRINTLN("EOF");
+    if ((pos % 10240) < n) {
+      PRINT(" ");
+      DEBUGLN(pos);
+    } else if ((pos % 1024) < n) { PRINT(">"); }
 #endif
-      break;
+    pos += n;
+  }
+
+  unsigned long elapsed = millis() - started;
+  _transfer_rate = elapsed ? (uint32_t) (pos * 1000UL / elapsed) : pos;
+  _stats.http_tx += pos;
+
+  if (pos < size) {
+#if !defined(NDEBUG) && defined(DEBUG_PROGRESS)
+    PRINTLN("EOF");
+#endif
+    // the chip expects exactly size bytes, fill up and do not post the incomplete data
+    memset(buffer, 0, block);
+    while (pos < size) {
+      size_t n = (size_t) min((uint32_t) block, size - pos);
+      _serial.write(buffer, n);
+      pos += n;
     }
-#ifndef NDEBUG
-    if ((pos % 10240) == 0) {
+    expect_OK(5000);
+    return 1009;
+  }
+
+  PRINTLN("");
+
+  if (!expect_OK(5000)) return 1005;
+
+  return HTTP_action(1, length);
+}
+
+void UbirchSIM800::setBuffer(char *buffer, size_t size) {
+  _buffer = buffer;
+  _buffer_size = size;
+}
+
+char *UbirchSIM800::transfer_buffer(size_t &size) {
+  if (_buffer) {
+    size = _buffer_size;
+    return _buffer;
+  }
+#ifdef SIM800_NO_ARENA
+  size = 0;
+  return NULL;
+#else
+  size = sizeof(_arena);
+  return _arena;
+#endif
+}
+
+uint32_t UbirchSIM800::transfer_rate() {
+  return _transfer_rate;
+}
+
+bool UbirchSIM800::HTTP_end() {
+  if (!_http_init) return true;
+  _http_init = false;
+  _http_url[0] = 0;
+  return expect_AT_OK(F("+HTTPTERM"));
+}
+
+unsigned short int UbirchSIM800::HTTP_session(const char *url) {
+  if (!_http_init) {
+    // a previous session may still be open on the chip
+    expect_AT_OK(F("+HTTPTERM"));
+    sleep(100);
+
+    if (!expect_AT_OK(F("+HTTPINIT"))) return 1000;
+    _http_init = true;
+    _http_url[0] = 0;
+
+    if (!expect_AT_OK(F("+HTTPPARA=\"CID\",1"))) return HTTP_abort(1101);
+    if (!expect_AT_OK(F("+HTTPPARA=\"UA\",\"UBIRCH#1\""))) return HTTP_abort(1102);
+    if (!expect_AT_OK(F("+HTTPPARA=\"REDIR\",1"))) return HTTP_abort(1103);
+  }
+
+  if (strcmp(url, _http_url)) {
+    _http_url[0] = 0;
+    println_param("AT+HTTPPARA=\"URL\"", url);
+    if (!expect_OK()) return HTTP_abort(1110);
+    // a URL that does not fit is sent again every time
+    if (strlen(url) < SIM800_HTTP_URL) strcpy(_http_url, url);
+  }
+
+  return 0;
+}
+
+uint32_t UbirchSIM800::HTTP_copy(STREAM &file, uint32_t start, uint32_t length, uint32_t *crc) {
+  size_t chunk;
+  char *buffer = transfer_buffer(chunk);
+  if (!buffer) return 0;
+
+  unsigned long started = millis();
+  uint32_t pos = 0;
+  while (pos < length) {
+    uint32_t reads = _stats.http_reads;
+    size_t r = HTTP_read(buffer, start + pos, (size_t) min((uint32_t) chunk, length - pos));
+    if (!r) {
+      // the chip answered but the data did not make it, a serial line that cannot keep up
+      // loses bytes of long answers, so continue with smaller chunks
+      if (reads == _stats.http_reads || chunk <= SIM800_BUFSIZE) break;
+      chunk /= 2;
+      rx_clear();
+      continue;
+    }
+#if !defined(NDEBUG) && defined(DEBUG_PROGRESS)
+    if ((pos % 10240) < r) {
       PRINT(" ");
       DEBUGLN(pos);
-    } else if (pos % (1024) == 0) { PRINT(">"); }
+    } else if ((pos % 1024) < r) { PRINT("<"); }
 #endif
     pos += r;
-  } while (r == SIM800_BUFSIZE);
-
-  free(buffer);
+    file.write((const uint8_t *) buffer, r);
+    if (crc) *crc = crc32(*crc, (const uint8_t *) buffer, r);
+  }
   PRINTLN("");
 
-  if (!expect_OK(5000)) return 1005;
+  unsigned long elapsed = millis() - started;
+  _transfer_rate = elapsed ? (uint32_t) (pos * 1000UL / elapsed) : pos;
+#if !defined(NDEBUG) && defined(DEBUG_PROGRESS)
+  PRINT("RATE: ");
+  DEBUG(_transfer_rate);
+  PRINTLN(" bytes/s");
+#endif
+  return pos;
+}
 
-  if (!expect_AT_OK(F("+HTTPACTION=1"))) return 1004;
+unsigned short int UbirchSIM800::HTTP_abort(unsigned short int error) {
+  HTTP_end();
+  return error;
+}
 
-  // wait for the action to be completed, give it 5s for each try
-  uint16_t status;
-  while (!expect_scan(F("+HTTPACTION: 1,%hu,%lu"), &status, &length, 5000));
+bool UbirchSIM800::HTTP_data(uint32_t size) {
+  print(F("AT+HTTPDATA="));
+  print(size);
+  print(F(","));
+  println((uint32_t) 120000);
 
-  return status;
+  if (expect(F("DOWNLOAD"))) return true;
+  HTTP_end();
+  return false;
 }
 
-inline size_t UbirchSIM800::read(char *buffer, size_t length) {
-  uint32_t idx = 0;
-  while (length) {
-    while (length && _serial.available()) {
-      buffer[idx++] = (char) _serial.read();
-      length--;
+unsigned short int UbirchSIM800::HTTP_action(uint8_t method, unsigned long int &length) {
+  print(F("AT+HTTPACTION="));
+  println((uint32_t) method);
+  if (!expect_OK()) return HTTP_abort(1004);
+
+  // wait for the action to be completed, other lines may arrive in between
+  unsigned long started = millis();
+  uint32_t action, status, size;
+  do {
+    if (expect_numbers(F("+HTTPACTION: "), action, status, size, 5000) && action == method) {
+      length = size;
+      // 6xx are network and chip errors, start over with a fresh session
+      if (status >= 600) HTTP_end();
+      return status;
+    }
+  } while (millis() - started < SIM800_HTTP_TIMEOUT);
+
+  return HTTP_abort(1008);
+}
+
+size_t UbirchSIM800::read(char *buffer, size_t length, uint16_t timeout) {
+  if (_line_ready) {
+    _rx_start = _rx_next;
+    _line_ready = false;
+  }
+
+  // drain what the tokenizer has already buffered, then continue with the serial input
+  size_t idx = min(length, (size_t) (_rx_end - _rx_start));
+  memcpy(buffer, _rx + _rx_start, idx);
+  _rx_start += idx;
+  if (_rx_scan < _rx_start) _rx_scan = _rx_start;
+
+  unsigned long last = millis();
+  while (idx < length) {
+    if (_serial.available()) {
+      while (idx < length && _serial.available()) buffer[idx++] = (char) _serial.read();
+      last = millis();
+    } else if (millis() - last >= timeout) {
+      // the chip delivered less than it announced
+      break;
+    } else {
+      idle();
     }
   }
   return idx;
 }
 
-bool UbirchSIM800::connect(const char *address, unsigned short int port, uint16_t timeout) {
-  if (!expect_AT(F("+CIPSHUT"), F("SHUT OK"))) return false;
-  if (!expect_AT_OK(F("+CMEE=2"))) return false;
-  if (!expect_AT_OK(F("+CIPQSEND=1"))) return false;
+bool UbirchSIM800::ip_up(uint16_t timeout) {
+  if (_ip_up) return true;
+
+  // the IP connection may still be up or half way there, only do the missing steps
+  uint8_t stage = SIM800_IP_SHUT;
+  println(F("AT+CIPMUX?"));
+  uint32_t mux = 0;
+  if (expect_numbers(F("+CIPMUX: "), mux) && expect_OK() && mux == 1) {
+    println(F("AT+CIPSTATUS"));
+    if (expect_OK()) {
+      // the state follows the OK, give up if it does not show up
+      size_t len;
+      unsigned long started = millis();
+      do {
+        if (millis() - started >= SIM800_SERIAL_TIMEOUT) return false;
+        len = wait_line(SIM800_SERIAL_TIMEOUT);
+      } while (is_urc(_line, len) || !len);
+      if (!strcmp_P(_line, PSTR("STATE: IP INITIAL"))) stage = SIM800_IP_INITIAL;
+      else if (!strcmp_P(_line, PSTR("STATE: IP START"))) stage = SIM800_IP_START;
+      else if (!strcmp_P(_line, PSTR("STATE: IP CONFIG")) || !strcmp_P(_line, PSTR("STATE: IP GPRSACT")))
+        stage = SIM800_IP_GPRSACT;
+      else if (!strcmp_P(_line, PSTR("STATE: IP STATUS")) || !strcmp_P(_line, PSTR("STATE: IP PROCESSING")))
+        stage = SIM800_IP_UP;
+
+      // the link states follow: C: <n>,<bearer>,<TCP/UDP>,<ip>,<port>,<state>
+      _links = 0;
+      for (;;) {
+        len = wait_line(100);
+        if (is_urc(_line, len)) continue;
+        if (len < 4 || strncmp_P(_line, PSTR("C: "), 3)) break;
+        if (_line[3] >= '0' && _line[3] < '0' + SIM800_LINKS && strstr_P(_line, PSTR("\"CONNECTED\"")))
+          _links |= 1 << (_line[3] - '0');
+      }
+    }
+  }
 
+  if (stage == SIM800_IP_SHUT) {
+    if (!expect_AT(F("+CIPSHUT"), F("SHUT OK"))) return false;
+    _links = _links_rx = 0;
+    if (!expect_AT_OK(F("+CIPMODE=0"))) return false;
+    if (!expect_AT_OK(F("+CIPMUX=1"))) return false;
+    stage = SIM800_IP_INITIAL;
+  }
+  if (stage == SIM800_IP_INITIAL) {
+    if (!expect_AT_OK(F("+CIPRXGET=1"))) return false;
+    if (!expect_AT_OK(F("+CMEE=2"))) return false;
+    if (!expect_AT_OK(F("+CIPQSEND=1"))) return false;
+  }
+
+  _ip_up = stage == SIM800_IP_UP || ip_start(timeout, stage);
+  return _ip_up;
+}
+
+bool UbirchSIM800::ip_start(uint16_t timeout, uint8_t stage) {
   // bring connection up, force it
-  print(F("AT+CSTT=\""));
-  print(_apn);
-  println(F("\""));
-  if (!expect_OK()) return false;
+  if (stage <= SIM800_IP_INITIAL) {
+    print(F("AT+CSTT=\""));
+    print(_apn);
+    println(F("\""));
+    if (!expect_OK()) return false;
+  }
 
-  if (!expect_AT_OK(F("+CIICR"))) return false;
+  if (stage <= SIM800_IP_START && !expect_AT_OK(F("+CIICR"), 10000)) return false;
 
   // try five times to get an IP address
   bool connected;
   do {
     char ipaddress[23];
     println(F("AT+CIFSR"));
-    expect_scan(F("%s"), ipaddress);
+    const char *p = expect_prefix(F(""));
+    if (!p || !scan_field(p, ipaddress, sizeof(ipaddress), ' ')) *ipaddress = '\0';
     connected = strcmp_P(ipaddress, PSTR("ERROR")) != 0;
-    if (!connected) delay(1);
+    if (!connected) sleep(1);
   } while (timeout-- && !connected);
 
-  if (!connected) return false;
+  return connected;
+}
 
-  print(F("AT+CIPSTART=0,\"TCP\",\""));
+bool UbirchSIM800::connect(const char *address, unsigned short int port, uint16_t timeout) {
+  return connect(0, address, port, timeout);
+}
+
+bool UbirchSIM800::connect(uint8_t link, const char *address, unsigned short int port, uint16_t timeout) {
+  if (link >= SIM800_LINKS || !ip_up(timeout)) return false;
+  if (_links & (1 << link)) disconnect(link);
+
+  print(F("AT+CIPSTART="));
+  print((uint32_t) link);
+  print(F(",\"TCP\",\""));
   print(address);
   print(F("\",\""));
   print(port);
   println(F("\""));
   if (!expect_OK()) return false;
-  if (!expect(F("0, CONNECT OK"), 30000)) return false;
+  if (!expect_link(link, F("CONNECT OK"), 30000)) return false;
 
-  return connected;
+  _links |= 1 << link;
+  _links_rx &= ~(1 << link);
+  _tx_sent[link] = _tx_accepted[link] = 0;
+  return true;
+}
+
+int8_t UbirchSIM800::open(const char *address, unsigned short int port, uint16_t timeout) {
+  // bringing up IP learns which links are still connected
+  if (!ip_up(timeout)) return -1;
+  poll_urc();
+  for (uint8_t link = 0; link < SIM800_LINKS; link++) {
+    if (_links & (1 << link)) continue;
+    return connect(link, address, port, timeout) ? link : -1;
+  }
+  return -1;
 }
 
 bool UbirchSIM800::status() {
-  println(F("AT+CIPSTATUS=0"));
+  return status(0);
+}
 
-  char status[SIM800_BUFSIZE];
-  expect_scan(F("+CIPSTATUS: %s"), status);
-  DEBUGLN(status);
+bool UbirchSIM800::status(uint8_t link) {
+  if (link >= SIM800_LINKS) return false;
+  print(F("AT+CIPSTATUS="));
+  println((uint32_t) link);
+
+  size_t len;
+  do len = wait_line(SIM800_SERIAL_TIMEOUT); while (is_urc(_line, len));
+  DEBUGLN(_line);
+  bool connected = !strncmp_P(_line, PSTR("+CIPSTATUS: "), 12) && strstr_P(_line, PSTR("\"CONNECTED\""));
   if (!expect_OK()) return false;
 
-  return strcmp_P(status, PSTR("CONNECTED")) < 0;
+  if (!connected) _links &= ~(1 << link);
+  return connected;
 }
 
 bool UbirchSIM800::disconnect() {
-  return expect_AT_OK(F("+CIPCLOSE=0"));
+  return disconnect(0);
 };
 
+bool UbirchSIM800::disconnect(uint8_t link) {
+  if (link >= SIM800_LINKS) return false;
+  print(F("AT+CIPCLOSE="));
+  println((uint32_t) link);
+  _links &= ~(1 << link);
+  _links_rx &= ~(1 << link);
+  return expect_link(link, F("CLOSE OK"), SIM800_SERIAL_TIMEOUT);
+}
+
+bool UbirchSIM800::available(uint8_t link) {
+  if (_transparent || link >= SIM800_LINKS) return false;
+  poll_urc();
+  return (_links_rx & (1 << link)) != 0;
+}
+
 bool UbirchSIM800::send(char *buffer, size_t size, unsigned long int &accepted) {
-  print(F("AT+CIPSEND=0,"));
-  println((uint32_t) size);
+  // waits for the chip to accept the data, like it always did
+  uint32_t start = _tx_sent[0];
+  bool ok = send(0, buffer, size, accepted) && send_flush(0);
+  accepted = accepted_since(0, start);
+  return ok && accepted == size;
+}
+
+bool UbirchSIM800::send(uint8_t link, char *buffer, size_t size, unsigned long int &accepted) {
+  if (link >= SIM800_LINKS) return false;
+  uint32_t start = _tx_sent[link];
+  size_t pos = 0;
+  while (pos < size) {
+    size_t block = min(size - pos, (size_t) SIM800_TX_CHUNK);
+    if (!send_prompt(link, block)) {
+      accepted = accepted_since(link, start);
+      return false;
+    }
+    _serial.write((const uint8_t *) buffer + pos, block);
+    _stats.tcp_tx += block;
+    _tx_sent[link] += block;
+    pos += block;
+  }
+
+  accepted = accepted_since(link, start);
+  return true;
+}
+
+bool UbirchSIM800::send_prompt(uint8_t link, size_t block) {
+  if (link >= SIM800_LINKS) return false;
+  // keep at most SIM800_SEND_WINDOW bytes in flight that the chip has not accepted yet
+  unsigned long started = millis();
+  while (_tx_sent[link] - _tx_accepted[link] + block > SIM800_SEND_WINDOW) {
+    if (millis() - started >= SIM800_SEND_TIMEOUT) return false;
+    poll_urc();
+    idle();
+  }
+
+  print(F("AT+CIPSEND="));
+  print((uint32_t) link);
+  print(F(","));
+  println((uint32_t) block);
+
+  // acceptance of earlier blocks may arrive in between and is counted by handle_urc()
+  return expect(F("> "));
+}
+
+bool UbirchSIM800::send(uint8_t link, sim800_writer_t writer, void *ctx, unsigned long int &accepted) {
+  if (link >= SIM800_LINKS) return false;
+  SIM800Counter counter;
+  writer(counter, ctx);
+
+  uint32_t start = _tx_sent[link];
+  SIM800Sender sender(*this, link, counter.count);
+  writer(sender, ctx);
+
+  accepted = accepted_since(link, start);
+  return sender.ok && sender.sent == counter.count;
+}
+
+bool UbirchSIM800::send(uint8_t link, STREAM &file, unsigned long int &accepted) {
+  size_t block;
+  char *buffer = transfer_buffer(block);
+  if (!buffer || link >= SIM800_LINKS) return false;
+
+  uint32_t start = _tx_sent[link];
+  bool ok = true;
+  while (ok) {
+    size_t n = 0;
+    while (n < block) {
+      int c = file.read();
+      if (c == -1) break;
+      buffer[n++] = (char) c;
+    }
+    if (!n) break;
+    ok = send(link, buffer, n, accepted);
+  }
+
+  accepted = accepted_since(link, start);
+  return ok;
+}
 
-  if (!expect(F("> "))) return false;
-  _serial.write((const uint8_t *) buffer, size);
+uint32_t UbirchSIM800::tx_accepted(uint8_t link) {
+  return link < SIM800_LINKS ? _tx_accepted[link] : 0;
+}
 
-  if (!expect_scan(F("DATA ACCEPT: 0,%lu"), &accepted, 3000)) {
-    // we have a buffer of 319488 bytes, so we are optimistic,
-    // even if a temporary fail occurs and just carry on
-    // (verified!)
-    //return false;
+uint32_t UbirchSIM800::accepted_since(uint8_t link, uint32_t start) {
+  // the chip accepts the data in the order it was sent, so what it accepted beyond
+  // start belongs to the data sent since then
+  uint32_t accepted = _tx_accepted[link] - start;
+  if ((int32_t) accepted < 0) return 0;
+  return min(accepted, _tx_sent[link] - start);
+}
+
+bool UbirchSIM800::send_flush(uint8_t link, uint16_t timeout) {
+  if (link >= SIM800_LINKS) return false;
+  unsigned long started = millis();
+  while (_tx_accepted[link] < _tx_sent[link]) {
+    if (millis() - started >= timeout) return false;
+    poll_urc();
+    idle();
   }
+  return true;
+}
 
-  return accepted == size;
+bool UbirchSIM800::acknowledged(uint8_t link, unsigned long int &sent, unsigned long int &acked,
+                                unsigned long int &nacked) {
+  if (link >= SIM800_LINKS) return false;
+  print(F("AT+CIPACK="));
+  println((uint32_t) link);
+  uint32_t s, a, n;
+  if (!expect_numbers(F("+CIPACK: "), s, a, n)) return false;
+  sent = s;
+  acked = a;
+  nacked = n;
+  return expect_OK();
 }
 
 size_t UbirchSIM800::receive(char *buffer, size_t size) {
-  size_t actual = 0;
-  while (actual < size) {
-    uint8_t chunk = (uint8_t) min(size - actual, 128);
-    print(F("AT+CIPRXGET=2,0,"));
-    println(chunk);
+  return receive(0, buffer, size);
+}
+
+size_t UbirchSIM800::receive(uint8_t link, char *buffer, size_t size, uint16_t timeout) {
+  if (link >= SIM800_LINKS) return 0;
 
-    unsigned long int requested, confirmed;
-    if (!expect_scan(F("+CIPRXGET: 2,%*d,%lu,%lu"), &requested, &confirmed)) return 0;
+  // wait for the chip to signal data, ask anyway if the notification did not show up
+  unsigned long started = millis();
+  while (!available(link) && millis() - started < timeout) idle();
 
-    actual += read(buffer, (size_t) confirmed);
+  print(F("AT+CIPRXGET=4,"));
+  println((uint32_t) link);
+  uint32_t mode, id, unread = 0;
+  if (!expect_numbers(F("+CIPRXGET: "), mode, id, unread) || mode != 4 || !expect_OK()) return 0;
+
+  size_t actual = 0;
+  while (actual < size && unread) {
+    size_t chunk = (size_t) min(min((uint32_t) (size - actual), unread), (uint32_t) SIM800_RX_CHUNK);
+    print(F("AT+CIPRXGET=2,"));
+    print((uint32_t) link);
+    print(F(","));
+    println((uint32_t) chunk);
+
+    // the chip reports the amount of data it returns and what is left unread
+    // +CIPRXGET: 2,<link>,<returned>,<unread>
+    uint32_t returned;
+    const char *p = expect_prefix(F("+CIPRXGET: 2,"));
+    if (!p || !scan_number(p, id) || !scan_next(p, returned) || !scan_next(p, unread)) break;
+    if (!returned) break;
+    actual += read(buffer + actual, (size_t) min(returned, (uint32_t) chunk));
+    if (!expect_OK()) break;
   }
 
+  if (!unread) _links_rx &= ~(1 << link);
+  _stats.tcp_rx += actual;
   return actual;
 }
 
+Stream *UbirchSIM800::connectTransparent(const char *address, unsigned short int port, uint16_t timeout) {
+  // transparent mode needs a single connection, this closes all links
+  if (!expect_AT(F("+CIPSHUT"), F("SHUT OK"))) return NULL;
+  _ip_up = false;
+  _links = _links_rx = 0;
+  if (!expect_AT_OK(F("+CIPMUX=0"))) return NULL;
+  if (!expect_AT_OK(F("+CIPRXGET=0"))) return NULL;
+  if (!expect_AT_OK(F("+CIPMODE=1"))) return NULL;
+  if (!ip_start(timeout, SIM800_IP_INITIAL)) return NULL;
+
+  print(F("AT+CIPSTART=\"TCP\",\""));
+  print(address);
+  print(F("\",\""));
+  print(port);
+  println(F("\""));
+  if (!expect_OK()) return NULL;
+  if (!expect(F("CONNECT"), 30000)) return NULL;
+
+  // from here on the serial line is connected to the socket
+  _transparent = true;
+  return &_transparent_stream;
+}
+
+bool UbirchSIM800::disconnectTransparent() {
+  if (!_transparent) return true;
+
+  // the escape sequence needs a second of silence before and after it (with a margin, sleep() counts whole ms)
+  _serial.flush();
+  sleep(1100);
+  _serial.print(F("+++"));
+  rx_clear();
+  _transparent = false;
+
+  // the chip answers when the second after it passed, until then socket data may still come in
+  bool escaped = false;
+  unsigned long started = millis();
+  while (!escaped && millis() - started < 2000) escaped = wait_line(2000) && !strcmp_P(_line, PSTR("OK"));
+  if (!escaped) {
+    // still connected to the socket
+    _transparent = true;
+    return false;
+  }
+
+  bool ok = expect_AT(F("+CIPCLOSE"), F("CLOSE OK"));
+  expect_AT(F("+CIPSHUT"), F("SHUT OK"));
+  return expect_AT_OK(F("+CIPMODE=0")) && ok;
+}
+
 /* ===========================================================================
  * PROTECTED
  * ===========================================================================
  */
 
-// read a line
-size_t UbirchSIM800::readline(char *buffer, size_t max, uint16_t timeout) {
-  uint16_t idx = 0;
-  while (--timeout) {
-    while (_serial.available()) {
-      char c = (char) _serial.read();
-      if (c == '\r') continue;
+void UbirchSIM800::setIdleCallback(void (*idle)()) {
+  _idle = idle;
+}
+
+bool UbirchSIM800::queue_AT(const __FlashStringHelper *cmd, const __FlashStringHelper *expected,
+                            sim800_callback_t callback, void *ctx, uint16_t timeout, const char *param) {
+  // in transparent mode everything sent goes into the socket
+  if (_transparent || _queue_len == SIM800_QUEUE_SIZE) return false;
+
+  command &c = _queue[(_queue_head + _queue_len) % SIM800_QUEUE_SIZE];
+  c.cmd = cmd;
+  c.param = param;
+  c.expected = expected ? expected : F("OK");
+  c.callback = callback;
+  c.ctx = ctx;
+  c.timeout = timeout;
+  _queue_len++;
+
+  return true;
+}
+
+bool UbirchSIM800::poll() {
+  // the input is socket data, it belongs to the transparent stream
+  if (_transparent) return false;
+
+  if (_queue_len && !_queue_active) {
+    command &c = _queue[_queue_head];
+#ifdef DEBUG_AT
+    PRINT("+++ AT");
+    DEBUG(c.cmd);
+    if (c.param) DEBUG(c.param);
+    DEBUGLN();
+#endif
+    _serial.print(F("AT"));
+    _serial.print(c.cmd);
+    if (c.param) _serial.print(c.param);
+    _serial.println();
+    stats_command((const char *) c.cmd, true);
+    _queue_active = true;
+    _queue_started = millis();
+  }
+
+  while (poll_line()) {
+    if (is_urc(_line, _line_len) || !_queue_active) continue;
+#ifdef DEBUG_AT
+    PRINT("--- (");
+    DEBUG(_line_len);
+    PRINT(") ");
+    DEBUGQLN(_line);
+#endif
+    command &c = _queue[_queue_head];
+    if (!strcmp_P(_line, (const char PROGMEM *) c.expected)) {
+      complete(SIM800_EVENT_OK);
+      break;
+    } else if (!strcmp_P(_line, PSTR("ERROR")) || !strncmp_P(_line, PSTR("+CME ERROR"), 10)) {
+      complete(SIM800_EVENT_ERROR);
+      break;
+    } else if (c.callback) {
+      c.callback(SIM800_EVENT_LINE, _line, _line_len, c.ctx);
+    }
+  }
+
+  if (_queue_active && millis() - _queue_started > _queue[_queue_head].timeout) {
+    stats_timeout();
+    complete(SIM800_EVENT_TIMEOUT);
+  }
+
+  return _queue_len > 0;
+}
+
+void UbirchSIM800::complete(uint8_t event) {
+  command c = _queue[_queue_head];
+  _queue_head = (uint8_t) ((_queue_head + 1) % SIM800_QUEUE_SIZE);
+  _queue_len--;
+  _queue_active = false;
+  _queue_result = event;
+
+  if (c.callback) {
+    if (event == SIM800_EVENT_TIMEOUT) c.callback(event, NULL, 0, c.ctx);
+    else c.callback(event, _line, _line_len, c.ctx);
+  }
+}
+
+#ifdef SIM800_TRACE
+void UbirchSIM800::dumpTrace(Print &out, bool clear) {
+  _serial.dump(out);
+  if (clear) _serial.clear();
+}
+#endif
+
+const sim800_stats_t &UbirchSIM800::stats() {
+  return _stats;
+}
+
+void UbirchSIM800::stats(sim800_stats_t &snapshot, bool reset) {
+  snapshot = _stats;
+  if (reset) resetStats();
+}
+
+void UbirchSIM800::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+  _stats_cmd = NULL;
+}
+
+void UbirchSIM800::stats_print(const char *s, bool progmem) {
+  if (_stats_in_line) return;
+  _stats_in_line = true;
+
+  char a = progmem ? (char) pgm_read_byte(s) : s[0];
+  char t = a ? (progmem ? (char) pgm_read_byte(s + 1) : s[1]) : 0;
+  if (a == 'A' && t == 'T') stats_command(s + 2, progmem);
+}
+
+void UbirchSIM800::stats_command(const char *cmd, bool progmem) {
+  char name[SIM800_STATS_NAME];
+  uint8_t n = 0;
+  for (; n < SIM800_STATS_NAME; n++) {
+    char c = progmem ? (char) pgm_read_byte(cmd + n) : cmd[n];
+    if (!c || c == '=' || c == '?') break;
+    name[n] = c;
+  }
+  memset(name + n, 0, SIM800_STATS_NAME - n);
+
+  // slots are taken in order, so the first free one means the command is not in the table yet
+  _stats_cmd = &_stats.other;
+  for (uint8_t i = 0; i < SIM800_STATS_COMMANDS; i++) {
+    sim800_command_stats_t &c = _stats.commands[i];
+    if (c.count && memcmp(c.name, name, SIM800_STATS_NAME)) continue;
+    memcpy(c.name, name, SIM800_STATS_NAME);
+    _stats_cmd = &c;
+    break;
+  }
+  _stats_cmd->count++;
+  _stats_started = millis();
+}
+
+// true if the line is one of SIM800_FINAL_RESULTS or an IP address
+static bool final_result(const char *line) {
+  const char *p = line;
+  uint8_t dots = 0;
+  while ((*p >= '0' && *p <= '9') || (*p == '.' && ++dots)) p++;
+  if (!*p && dots == 3) return true;
+
+  if (line[0] >= '0' && line[0] <= '9' && line[1] == ',') line += line[2] == ' ' ? 3 : 2;
+#define SIM800_FINAL_RESULT(result) if (!strcmp_P(line, PSTR(result))) return true;
+#define SIM800_FINAL_PREFIX(prefix) if (!strncmp_P(line, PSTR(prefix), sizeof(prefix) - 1)) return true;
+  SIM800_FINAL_RESULTS(SIM800_FINAL_RESULT, SIM800_FINAL_PREFIX)
+#undef SIM800_FINAL_RESULT
+#undef SIM800_FINAL_PREFIX
+  return false;
+}
+
+void UbirchSIM800::stats_result() {
+  // a URC on the wire while the command runs (DATA ACCEPT) does not end it
+  if (!_stats_cmd || !final_result(_line) || urc_match(_line, _line_len) != SIM800_URC_COUNT) return;
+
+  uint16_t latency = (uint16_t) min(millis() - _stats_started, 0xffffUL);
+  sim800_command_stats_t &c = *_stats_cmd;
+  if (!c.answered || latency < c.min) c.min = latency;
+  if (latency > c.max) c.max = latency;
+  c.total += latency;
+  c.answered++;
+  _stats_cmd = NULL;
+}
+
+void UbirchSIM800::stats_timeout() {
+  if (!_stats_cmd) return;
+  _stats_cmd->timeouts++;
+  _stats_cmd = NULL;
+}
+
+void UbirchSIM800::flush_queue() {
+  while (poll()) idle();
+}
+
+void UbirchSIM800::idle() {
+  if (_idle) _idle();
+}
+
+void UbirchSIM800::sleep(uint16_t ms) {
+  unsigned long started = millis();
+  while (millis() - started < ms) idle();
+}
+
+bool UbirchSIM800::poll_line() {
+  if (_line_ready) {
+    _rx_start = _rx_next;
+    _line_ready = false;
+  }
+
+  for (;;) {
+    if (_rx_start == _rx_end) _rx_start = _rx_end = _rx_scan = 0;
+
+    while (_rx_scan < _rx_end) {
+      char c = _rx[_rx_scan++];
       if (c == '\n') {
-        if (!idx) continue;
-        timeout = 0;
-        break;
+        uint16_t end = (uint16_t) (_rx_scan - 1);
+        while (end > _rx_start && _rx[end - 1] == '\r') end--;
+        // skip empty lines and the echo of a command (until ATE0 in boot()), no answer starts with AT
+        if (end > _rx_start && !(end - _rx_start >= 2 && _rx[_rx_start] == 'A' && _rx[_rx_start + 1] == 'T'))
+          return take_line(end);
+        _rx_start = _rx_scan;
+      } else if (c == ' ' && _rx_scan - _rx_start == 2 && _rx[_rx_start] == '>') {
+        // the data prompt is not terminated by a newline and other output may follow it directly,
+        // so hand out a copy instead of terminating it in place
+        static char prompt[] = "> ";
+        _line = prompt;
+        _line_len = 2;
+        _rx_next = _rx_scan;
+        _line_ready = true;
+        stats_result();
+        return true;
       }
-      if (max - idx) buffer[idx++] = c;
     }
 
-    if (timeout == 0) break;
-    delay(1);
+    // the line does not fit into the buffer, hand out what we have
+    if (_rx_start == 0 && _rx_end == SIM800_RXBUFSIZE) {
+      _rx_scan = _rx_end;
+      return take_line(_rx_end);
+    }
+
+    if (!_serial.available()) return false;
+
+    if (_rx_end == SIM800_RXBUFSIZE) {
+      memmove(_rx, _rx + _rx_start, (size_t) (_rx_end - _rx_start));
+      _rx_end -= _rx_start;
+      _rx_scan -= _rx_start;
+      _rx_start = 0;
+    }
+    while (_rx_end < SIM800_RXBUFSIZE && _serial.available()) _rx[_rx_end++] = (char) _serial.read();
   }
-  buffer[idx] = 0;
-  return idx;
+}
+
+bool UbirchSIM800::take_line(uint16_t end) {
+  _line = _rx + _rx_start;
+  _line_len = end - _rx_start;
+  _rx_next = _rx_scan;
+  // terminate in place, the terminator replaces the line end
+  _rx[end] = 0;
+  _line_ready = true;
+  stats_result();
+  return true;
+}
+
+int UbirchSIM800::rx_available() {
+  if (_line_ready) {
+    _rx_start = _rx_next;
+    _line_ready = false;
+  }
+  return (_rx_end - _rx_start) + _serial.available();
+}
+
+int UbirchSIM800::rx_read(bool consume) {
+  if (!rx_available()) return -1;
+  if (_rx_start == _rx_end) return consume ? _serial.read() : _serial.peek();
+
+  int c = (uint8_t) _rx[_rx_start];
+  if (consume && ++_rx_start > _rx_scan) _rx_scan = _rx_start;
+  return c;
+}
+
+void UbirchSIM800::poll_urc() {
+  if (_queue_len || _transparent) return;
+  while (poll_line()) is_urc(_line, _line_len);
+}
+
+void UbirchSIM800::rx_clear() {
+  _rx_start = _rx_end = _rx_scan = 0;
+  _line_ready = false;
+  while (_serial.available()) _serial.read();
+}
+
+size_t UbirchSIM800::wait_line(uint16_t timeout) {
+  unsigned long started = millis();
+  while (!poll_line()) {
+    if (millis() - started >= timeout) {
+      // return what we have got so far
+      _rx_scan = _rx_end;
+      take_line(_rx_end);
+      if (!_line_len) stats_timeout();
+      break;
+    }
+    idle();
+  }
+  return _line_len;
+}
+
+// read a line
+size_t UbirchSIM800::readline(char *buffer, size_t max, uint16_t timeout) {
+  size_t len = min(wait_line(timeout), max - 1);
+  memcpy(buffer, _line, len);
+  buffer[len] = 0;
+  return len;
 };
 
 void UbirchSIM800::eat_echo() {
-  while (_serial.available()) {
-    _serial.read();
-    // don't be too quick or we might not have anything available
-    // when there actually is...
-    delay(1);
-  }
+  // handle the unsolicited result codes that are waiting and drop the other complete lines,
+  // a line still arriving stays in the buffer, it may be a URC (the echo is skipped by poll_line())
+  poll_urc();
 }
 
 void UbirchSIM800::print(const __FlashStringHelper *s) {
+  if (_transparent) return;
+  if (_queue_len) flush_queue();
 #ifdef DEBUG_AT
   PRINT("+++ ");
   DEBUGQLN(s);
 #endif
+  stats_print((const char *) s, true);
   _serial.print(s);
 }
 
 void UbirchSIM800::print(uint32_t s) {
+  if (_transparent) return;
+  if (_queue_len) flush_queue();
 #ifdef DEBUG_AT
   PRINT("+++ ");
   DEBUGLN(s);
 #endif
+  _stats_in_line = true;
   _serial.print(s);
 }
 
 
 void UbirchSIM800::println(const __FlashStringHelper *s) {
+  if (_transparent) return;
+  if (_queue_len) flush_queue();
 #ifdef DEBUG_AT
   PRINT("+++ ");
   DEBUGQLN(s);
 #endif
+  stats_print((const char *) s, true);
   _serial.print(s);
   eat_echo();
   _serial.println();
+  _stats_in_line = false;
 }
 
 void UbirchSIM800::println(uint32_t s) {
+  if (_transparent) return;
+  if (_queue_len) flush_queue();
 #ifdef DEBUG_AT
   PRINT("+++ ");
   DEBUGLN(s);
@@ -634,33 +1710,42 @@ void UbirchSIM800::println(uint32_t s) {
   _serial.print(s);
   eat_echo();
   _serial.println();
+  _stats_in_line = false;
 }
 
 #ifdef __AVR__
 
 void UbirchSIM800::println(const char *s) {
+  if (_transparent) return;
+  if (_queue_len) flush_queue();
 #ifdef DEBUG_AT
   PRINT("+++ ");
   DEBUGQLN(s);
 #endif
+  stats_print((const char *) s, false);
   _serial.print(s);
   eat_echo();
   _serial.println();
+  _stats_in_line = false;
 }
 
 void UbirchSIM800::print(const char *s) {
+  if (_transparent) return;
+  if (_queue_len) flush_queue();
 #ifdef DEBUG_AT
   PRINT("+++ ");
   DEBUGQLN(s);
 #endif
+  stats_print((const char *) s, false);
   _serial.print(s);
 }
 #endif
 
 bool UbirchSIM800::expect_AT(const __FlashStringHelper *cmd, const __FlashStringHelper *expected, uint16_t timeout) {
-  print(F("AT"));
-  println(cmd);
-  return expect(expected, timeout);
+  flush_queue();
+  if (!queue_AT(cmd, expected, NULL, NULL, timeout)) return false;
+  flush_queue();
+  return _queue_result == SIM800_EVENT_OK;
 }
 
 bool UbirchSIM800::expect_AT_OK(const __FlashStringHelper *cmd, uint16_t timeout) {
@@ -668,85 +1753,178 @@ bool UbirchSIM800::expect_AT_OK(const __FlashStringHelper *cmd, uint16_t timeout
 }
 
 bool UbirchSIM800::expect(const __FlashStringHelper *expected, uint16_t timeout) {
-  char buf[SIM800_BUFSIZE];
   size_t len;
-  do len = readline(buf, SIM800_BUFSIZE, timeout); while (is_urc(buf, len));
+  do len = wait_line(timeout); while (is_urc(_line, len));
 #ifdef DEBUG_AT
   PRINT("--- (");
   DEBUG(len);
   PRINT(") ");
-  DEBUGQLN(buf);
+  DEBUGQLN(_line);
 #endif
-  return strcmp_P(buf, (const char PROGMEM *) expected) == 0;
+  return strcmp_P(_line, (const char PROGMEM *) expected) == 0;
 }
 
 bool UbirchSIM800::expect_OK(uint16_t timeout) {
   return expect(F("OK"), timeout);
 }
 
-bool UbirchSIM800::expect_scan(const __FlashStringHelper *pattern, void *ref, uint16_t timeout) {
-  char buf[SIM800_BUFSIZE];
+const char *UbirchSIM800::expect_prefix(const __FlashStringHelper *prefix, uint16_t timeout) {
   size_t len;
-  do len = readline(buf, SIM800_BUFSIZE, timeout); while (is_urc(buf, len));
+  do len = wait_line(timeout); while (is_urc(_line, len));
 #ifdef DEBUG_AT
   PRINT("--- (");
   DEBUG(len);
   PRINT(") ");
-  DEBUGQLN(buf);
+  DEBUGQLN(_line);
 #endif
-  return sscanf_P(buf, (const char PROGMEM *) pattern, ref) == 1;
+  size_t prefix_len = strlen_P((const char PROGMEM *) prefix);
+  if (strncmp_P(_line, (const char PROGMEM *) prefix, prefix_len)) return NULL;
+  return _line + prefix_len;
 }
 
-bool UbirchSIM800::expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, uint16_t timeout) {
-  char buf[SIM800_BUFSIZE];
-  size_t len;
-  do len = readline(buf, SIM800_BUFSIZE, timeout); while (is_urc(buf, len));
-#ifdef DEBUG_AT
-  PRINT("--- (");
-  DEBUG(len);
-  PRINT(") ");
-  DEBUGQLN(buf);
-#endif
-  return sscanf_P(buf, (const char PROGMEM *) pattern, ref, ref1) == 2;
+bool UbirchSIM800::expect_numbers(const __FlashStringHelper *prefix, uint32_t &n, uint16_t timeout) {
+  const char *p = expect_prefix(prefix, timeout);
+  return p && scan_number(p, n);
 }
 
-bool UbirchSIM800::expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2,
-                               uint16_t timeout) {
-  char buf[SIM800_BUFSIZE];
-  size_t len;
-  do len = readline(buf, SIM800_BUFSIZE, timeout); while (is_urc(buf, len));
-#ifdef DEBUG_AT
-  PRINT("--- (");
-  DEBUG(len);
-  PRINT(") ");
-  DEBUGQLN(buf);
-#endif
-  return sscanf_P(buf, (const char PROGMEM *) pattern, ref, ref1, ref2) == 3;
+bool UbirchSIM800::expect_numbers(const __FlashStringHelper *prefix, uint32_t &n, uint32_t &n1, uint16_t timeout) {
+  const char *p = expect_prefix(prefix, timeout);
+  return p && scan_number(p, n) && scan_next(p, n1);
+}
+
+bool UbirchSIM800::expect_numbers(const __FlashStringHelper *prefix, uint32_t &n, uint32_t &n1, uint32_t &n2,
+                                  uint16_t timeout) {
+  const char *p = expect_prefix(prefix, timeout);
+  return p && scan_number(p, n) && scan_next(p, n1) && scan_next(p, n2);
+}
+
+void UbirchSIM800::onURC(uint8_t urc, sim800_urc_handler_t handler) {
+  if (urc < SIM800_URC_COUNT) _urc_handlers[urc] = handler;
 }
 
 bool UbirchSIM800::is_urc(const char *line, size_t len) {
-  urc_status = 0xff;
+  if (len < 3) return false;
+
+  // "<link>, CLOSED" is sent when the remote side closes a connection
+  if (line[0] >= '0' && line[0] < '0' + SIM800_LINKS && !strcmp_P(line + 1, PSTR(", CLOSED"))) {
+    _links &= ~(1 << (line[0] - '0'));
+    return true;
+  }
+
+  const uint8_t i = urc_match(line, len);
+  if (i == SIM800_URC_COUNT) return false;
 
-  for (uint8_t i = 0; i < 17; i++) {
-#ifdef __AVR__
-    const char *urc = (const char *) pgm_read_word(&(_urc_messages[i]));
-#else
-    const char *urc = _urc_messages[i];
-#endif
-    size_t urc_len = strlen(urc);
-    if (len >= urc_len && !strncmp(urc, line, urc_len)) {
 #ifdef DEBUG_URC
-      PRINT("!!! SIM800 URC(");
-      DEBUG(i);
-      PRINT(") ");
-      DEBUGLN(urc);
+  PRINT("!!! SIM800 URC(");
+  DEBUG(i);
+  PRINT(") ");
+  DEBUGLN(line);
 #endif
-      urc_status = i;
-      return true;
+  urc_status = i;
+  _stats.urcs[i]++;
+  handle_urc(i, line, len);
+  if (_urc_handlers[i]) _urc_handlers[i](i, line, len);
+  return true;
+}
+
+void UbirchSIM800::handle_urc(uint8_t urc, const char *line, size_t len) {
+  switch (urc) {
+    case SIM800_URC_CIPRXGET:
+      // "+CIPRXGET: 1,<link>"
+      if (len > 13 && line[13] >= '0' && line[13] < '0' + SIM800_LINKS) _links_rx |= 1 << (line[13] - '0');
+      break;
+    case SIM800_URC_DATA_ACCEPT: {
+      // "DATA ACCEPT:<link>,<length>", may contain a space after the colon
+      const char *p = line + 12;
+      scan_char(p, ' ');
+      uint32_t link, accepted;
+      if (scan_number(p, link) && scan_next(p, accepted) && link < SIM800_LINKS) _tx_accepted[link] += accepted;
+      break;
+    }
+    case SIM800_URC_PDP_DEACT:
+      // the network dropped the PDP context, all connections are gone
+      _ip_up = false;
+      _links = _links_rx = 0;
+      _bearer_up = false;
+      _http_init = false;
+      break;
+    case SIM800_URC_SAPBR_DEACT:
+      _bearer_up = false;
+      _http_init = false;
+      break;
+    case SIM800_URC_CREG: {
+      // "+CREG: <stat>[,"<lac>","<ci>"]" or the answer to AT+CREG? "+CREG: <n>,<stat>[,"<lac>","<ci>"]"
+      const char *p = line + 7;
+      uint16_t stat = 0, lac = 0, ci = 0;
+      scan_number(p, stat);
+      if (p[0] == ',' && p[1] >= '0' && p[1] <= '9') scan_next(p, stat);
+      if (scan_char(p, ',') && scan_char(p, '"') && scan_number(p, lac, 16))
+        if (scan_char(p, '"') && scan_char(p, ',') && scan_char(p, '"')) scan_number(p, ci, 16);
+      if (stat != _creg || lac != _lac || ci != _ci) {
+        _creg = (uint8_t) stat;
+        _lac = lac;
+        _ci = ci;
+        if (_creg_handler) _creg_handler(_creg, lac, ci);
+      }
+      break;
     }
+    default:
+      break;
   }
+}
+
+bool UbirchSIM800::expect_link(uint8_t link, const __FlashStringHelper *expected, uint16_t timeout) {
+  unsigned long started = millis();
+  do {
+    size_t len;
+    do len = wait_line(timeout); while (is_urc(_line, len));
+#ifdef DEBUG_AT
+    PRINT("--- (");
+    DEBUG(len);
+    PRINT(") ");
+    DEBUGQLN(_line);
+#endif
+    // skip reports of other links
+    if (len > 3 && _line[0] == '0' + link && _line[1] == ',' && _line[2] == ' ')
+      return strcmp_P(_line + 3, (const char PROGMEM *) expected) == 0;
+    if (!strcmp_P(_line, PSTR("ERROR"))) return false;
+  } while (millis() - started < timeout);
 
   return false;
 }
 
+/* ===========================================================================
+ * TRANSPARENT MODE STREAM
+ * ===========================================================================
+ */
+
+UbirchSIM800Stream::UbirchSIM800Stream(UbirchSIM800 &sim800) : _sim800(sim800) {
+}
+
+int UbirchSIM800Stream::available() {
+  return _sim800.rx_available();
+}
+
+int UbirchSIM800Stream::read() {
+  int c = _sim800.rx_read(true);
+  if (c != -1) _sim800._stats.tcp_rx++;
+  return c;
+}
 
+int UbirchSIM800Stream::peek() {
+  return _sim800.rx_read(false);
+}
+
+void UbirchSIM800Stream::flush() {
+  _sim800._serial.flush();
+}
+
+size_t UbirchSIM800Stream::write(uint8_t c) {
+  _sim800._stats.tcp_tx++;
+  return _sim800._serial.write(c);
+}
+
+size_t UbirchSIM800Stream::write(const uint8_t *buffer, size_t size) {
+  _sim800._stats.tcp_tx += size;
+  return _sim800._serial.write(buffer, size);
+}
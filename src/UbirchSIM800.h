@@ -30,21 +30,62 @@
 
 #define STREAM Stream
 
+// all settings below may be overridden with build flags (-DSIM800_HTTP_CHUNK=512)
+// SIM800_RXBUFSIZE, SIM800_HTTP_URL, SIM800_QUEUE_SIZE, SIM800_STATS_COMMANDS, SIM800_TRACE and SIM800_SERIAL_TYPE
+// change the layout of UbirchSIM800, so they must be global build flags that are the same for
+// the library and every sketch source, defining them in a sketch before the include is not enough
 #ifdef __AVR__
-#include <SoftwareSerial.h>
 // this is the maximum I could do using the board-mounted SIM800 on the ubirch #1
 // if you are using an externally wired Modem, you may have to try a lower baud rate
+#ifndef SIM800_BAUD
 #define SIM800_BAUD 57600
+#endif
+#ifndef SIM800_BAUD_MAX
+#define SIM800_BAUD_MAX 57600
+#endif
+#ifndef SIM800_RX
 #define SIM800_RX   2
+#endif
+#ifndef SIM800_TX
 #define SIM800_TX   3
+#endif
+#ifndef SIM800_RST
 #define SIM800_RST  4
-#define SIM800_KEY  7
-#define SIM800_PS   8
+#endif
+#ifndef SIM800_RXBUFSIZE
+#define SIM800_RXBUFSIZE 128
+#endif
+#ifndef SIM800_HTTP_CHUNK
+#define SIM800_HTTP_CHUNK 256
+#endif
+#ifndef SIM800_SEND_WINDOW
+#define SIM800_SEND_WINDOW 2920
+#endif
+#ifndef SIM800_HTTP_URL
+#define SIM800_HTTP_URL 64
+#endif
 #else
+#ifndef SIM800_BAUD
 #define SIM800_BAUD 115200
+#endif
+#ifndef SIM800_BAUD_MAX
+#define SIM800_BAUD_MAX 460800
+#endif
+#ifndef SIM800_RST
 #define SIM800_RST  6
-#define SIM800_KEY  7
-#define SIM800_PS   8
+#endif
+#ifndef SIM800_RXBUFSIZE
+#define SIM800_RXBUFSIZE 256
+#endif
+#ifndef SIM800_HTTP_CHUNK
+#define SIM800_HTTP_CHUNK 1024
+#endif
+#ifndef SIM800_SEND_WINDOW
+#define SIM800_SEND_WINDOW 5840
+#endif
+#ifndef SIM800_HTTP_URL
+#define SIM800_HTTP_URL 256
+#endif
 #ifdef F
 #undef F
 #define F(s) (s)
@@ -52,14 +93,249 @@
 #define __FlashStringHelper char
 #endif
 
+#ifndef SIM800_KEY
+#define SIM800_KEY  7
+#endif
+#ifndef SIM800_PS
+#define SIM800_PS   8
+#endif
+
+// the serial port the chip is connected to, the type is concrete so calls are bound at compile time
+// any class with begin(), the Stream methods and Print (for request writers) can be used, e.g. a mock
+#ifdef SIM800_SERIAL_INCLUDE
+#include SIM800_SERIAL_INCLUDE
+#endif
+#ifndef SIM800_SERIAL_TYPE
+#ifdef __AVR__
+#include <SoftwareSerial.h>
+#define SIM800_SERIAL_TYPE SoftwareSerial
+#define SIM800_SERIAL_INIT SoftwareSerial(SIM800_TX, SIM800_RX)
+#else
+#define SIM800_SERIAL_TYPE HardwareSerial2
+#define SIM800_SERIAL_INIT Serial2
+#endif
+#endif
+#ifndef SIM800_SERIAL_INIT
+#define SIM800_SERIAL_INIT SIM800_SERIAL_TYPE()
+#endif
+
+// record the serial traffic into a ring of SIM800_TRACE bytes (see UbirchSIM800Trace.h)
+#include "UbirchSIM800Trace.h"
+
+#ifndef SIM800_CMD_TIMEOUT
 #define SIM800_CMD_TIMEOUT 30000
+#endif
+#ifndef SIM800_SERIAL_TIMEOUT
 #define SIM800_SERIAL_TIMEOUT 1000
+#endif
+#ifndef SIM800_HTTP_TIMEOUT
+#define SIM800_HTTP_TIMEOUT 60000
+#endif
+// size of the ranges HTTP_download() requests, must stay below the chip limit of 319488 bytes
+#ifndef SIM800_HTTP_RANGE
+#define SIM800_HTTP_RANGE 262144UL
+#endif
+// attempts to recover a download that made no progress before giving up
+#ifndef SIM800_HTTP_RETRIES
+#define SIM800_HTTP_RETRIES 3
+#endif
+#ifndef SIM800_BOOT_TIMEOUT
+#define SIM800_BOOT_TIMEOUT 10000
+#endif
+#ifndef SIM800_PROBE_TIMEOUT
+#define SIM800_PROBE_TIMEOUT 250
+#endif
+#ifndef SIM800_CREG_BACKOFF
+#define SIM800_CREG_BACKOFF 250
+#endif
+#ifndef SIM800_CREG_BACKOFF_MAX
+#define SIM800_CREG_BACKOFF_MAX 4000
+#endif
+#ifndef SIM800_BUFSIZE
 #define SIM800_BUFSIZE 64
+#endif
+#ifndef SIM800_QUEUE_SIZE
+#define SIM800_QUEUE_SIZE 4
+#endif
+#ifndef SIM800_SEND_TIMEOUT
+#define SIM800_SEND_TIMEOUT 3000
+#endif
+#ifndef SIM800_STATS_COMMANDS
+#ifdef __AVR__
+#define SIM800_STATS_COMMANDS 6
+#else
+#define SIM800_STATS_COMMANDS 16
+#endif
+#endif
+#define SIM800_STATS_NAME 10
+#define SIM800_LINKS 6
+#define SIM800_RX_CHUNK 1460
+#define SIM800_TX_CHUNK 1460
+
+// how far the TCP/IP connection is up (AT+CIPSTATUS)
+#define SIM800_IP_SHUT    0
+#define SIM800_IP_INITIAL 1
+#define SIM800_IP_START   2
+#define SIM800_IP_GPRSACT 3
+#define SIM800_IP_UP      4
+
+// events delivered to the callback of an asynchronous command
+#define SIM800_EVENT_LINE    0
+#define SIM800_EVENT_OK      1
+#define SIM800_EVENT_ERROR   2
+#define SIM800_EVENT_TIMEOUT 3
+
+// callback for asynchronous commands, receives intermediate lines and the final result
+typedef void (*sim800_callback_t)(uint8_t event, const char *line, size_t len, void *ctx);
+
+// handler for unsolicited result codes, urc is one of the SIM800_URC_* ids
+typedef void (*sim800_urc_handler_t)(uint8_t urc, const char *line, size_t len);
+
+// handler for network registration changes, status as in +CREG (1 = home, 5 = roaming)
+typedef void (*sim800_registration_handler_t)(uint8_t status, uint16_t lac, uint16_t ci);
+
+// approximate location as reported by AT+CIPGSMLOC
+struct sim800_location_t {
+    char lon[12];
+    char lat[12];
+    char date[11];
+    char time[9];
+};
+
+// progress of a resumable download, keep it (e.g. in EEPROM) together with the file to continue after a reset
+struct sim800_download_t {
+    uint32_t offset; // bytes received and written to the file
+    uint32_t size;   // total size, 0 if not known (found when the server sends less than requested)
+    uint32_t crc;    // CRC-32 of the received bytes (same as zlib crc32()), 0 to start with
+};
+
+// called when a download made progress, file and progress must be persisted together
+typedef void (*sim800_download_handler_t)(const sim800_download_t &progress, void *ctx);
+
+// writes a request body, called twice (to count the bytes and to send them) so it must write the same data
+typedef void (*sim800_writer_t)(Print &out, void *ctx);
+
+// this useful list found here: https://github.com/cloudyourcar/attentive
+// the table generates the URC ids, the messages and the lookup tables used by is_urc(),
+// a new message also needs a case in urc_candidate() (UbirchSIM800.cpp)
+#define SIM800_URCS(URC) \
+  /* incoming socket data notification */ \
+  URC(CIPRXGET, "+CIPRXGET: 1,") \
+  /* FTP state change notification */ \
+  URC(FTPGET, "+FTPGET: 1,") \
+  /* PDP disconnected */ \
+  URC(PDP_DEACT, "+PDP: DEACT") \
+  /* PDP disconnected (for SAPBR apps) */ \
+  URC(SAPBR_DEACT, "+SAPBR 1: DEACT") \
+  /* AT+CLTS network name */ \
+  URC(PSNWID, "*PSNWID:") \
+  /* AT+CLTS time */ \
+  URC(PSUTTZ, "*PSUTTZ:") \
+  /* AT+CLTS timezone */ \
+  URC(CTZV, "+CTZV:") \
+  /* AT+CLTS dst information */ \
+  URC(DST, "DST:") \
+  /* AT+CLTS undocumented indicator */ \
+  URC(CIEV, "+CIEV:") \
+  /* Assorted crap on newer firmware releases. */ \
+  URC(RDY, "RDY") \
+  URC(CPIN_READY, "+CPIN: READY") \
+  URC(CALL_READY, "Call Ready") \
+  URC(SMS_READY, "SMS Ready") \
+  URC(NORMAL_POWER_DOWN, "NORMAL POWER DOWN") \
+  URC(UNDER_VOLTAGE_POWER_DOWN, "UNDER-VOLTAGE POWER DOWN") \
+  URC(UNDER_VOLTAGE_WARNING, "UNDER-VOLTAGE WARNNING") \
+  URC(OVER_VOLTAGE_POWER_DOWN, "OVER-VOLTAGE POWER DOWN") \
+  URC(OVER_VOLTAGE_WARNING, "OVER-VOLTAGE WARNNING") \
+  /* quick send mode (AT+CIPQSEND=1) data acceptance */ \
+  URC(DATA_ACCEPT, "DATA ACCEPT:") \
+  /* network registration (AT+CREG=2), also the answer to AT+CREG? */ \
+  URC(CREG, "+CREG: ")
+
+// final results that end a command, used for the command statistics and by tools/sim800_trace.py,
+// RESULT is the whole line and PREFIX its start, both may follow a link number ("<n>, "), the
+// IP address AT+CIFSR answers with ends a command too
+#define SIM800_FINAL_RESULTS(RESULT, PREFIX) \
+  RESULT("OK") \
+  RESULT("ERROR") \
+  PREFIX("+CME ERROR") \
+  PREFIX("+CMS ERROR") \
+  RESULT("> ") \
+  RESULT("DOWNLOAD") \
+  RESULT("SHUT OK") \
+  RESULT("CLOSE OK") \
+  RESULT("SEND OK") \
+  RESULT("SEND FAIL") \
+  PREFIX("DATA ACCEPT") \
+  RESULT("CONNECT OK") \
+  RESULT("CONNECT FAIL") \
+  RESULT("ALREADY CONNECT") \
+  RESULT("NO CARRIER")
+
+#define SIM800_URC_ID(id, message) SIM800_URC_##id,
+enum {
+    SIM800_URCS(SIM800_URC_ID)
+    SIM800_URC_COUNT
+};
+#undef SIM800_URC_ID
+
+// counters of an AT command, the latency is the time in ms until the final result (mean = total / answered)
+struct sim800_command_stats_t {
+    char name[SIM800_STATS_NAME]; // command without AT and parameters, cut to the field size (not terminated then)
+    uint16_t count;
+    uint16_t answered;
+    uint16_t timeouts;
+    uint16_t min;
+    uint16_t max;
+    uint32_t total;
+};
+
+// statistics, updated in place as the chip is used
+struct sim800_stats_t {
+    sim800_command_stats_t commands[SIM800_STATS_COMMANDS];
+    sim800_command_stats_t other; // commands that did not fit into the table
+    uint16_t urcs[SIM800_URC_COUNT];
+    uint32_t http_tx;       // HTTP body bytes posted
+    uint32_t http_rx;       // HTTP body bytes read
+    uint16_t http_reads;    // AT+HTTPREAD chunks
+    uint32_t tcp_tx;        // bytes sent on links and in transparent mode
+    uint32_t tcp_rx;        // bytes received on links and in transparent mode
+    uint32_t reset_time;    // ms spent in reset() and wakeup()
+    uint32_t register_time; // ms spent in registerNetwork()
+    uint32_t gprs_time;     // ms spent in enableGPRS()
+};
+
+class UbirchSIM800;
+
+// the data connection of a transparent mode (AT+CIPMODE=1) TCP connection
+class UbirchSIM800Stream : public Stream {
+public:
+    UbirchSIM800Stream(UbirchSIM800 &sim800);
+
+    virtual int available();
+
+    virtual int read();
+
+    virtual int peek();
+
+    virtual void flush();
+
+    virtual size_t write(uint8_t c);
+
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    using Print::write;
+
+private:
+    UbirchSIM800 &_sim800;
+};
 
 class UbirchSIM800 {
+    friend class UbirchSIM800Stream;
+    friend class SIM800Sender;
 
 public:
-    // if an unsolicitited result code is detected, it's number (0-18) is set here
+    // if an unsolicitited result code is detected, it's id (SIM800_URC_*) is set here
     uint8_t urc_status = 0xff;
 
     UbirchSIM800();
@@ -78,43 +354,114 @@ public:
     // shut down the SIM chip to reduce power usage
     bool shutdown();
 
-    // wake up the chip, checks if it's already awake, resets the chip (see #reset())
+    // wake up the chip, resets it if it is already awake (see #reset()), otherwise powers it on,
+    // a chip that runs at another rate (stored with AT&W) counts as awake
     bool wakeup();
 
-    // wait for network registration
+    // switch to the fastest baud rate up to max that works, stores it in the chip if persist is set
+    // so it starts with this rate after a reset (wakeup() and reset() then have to search for it
+    // after an MCU reset), returns the baud rate in use
+    uint32_t negotiateBaud(uint32_t max = SIM800_BAUD_MAX, bool persist = false);
+
+    // switch the chip and the serial port to the given baud rate (AT+IPR), falls back to the
+    // current rate if the new one does not work
+    bool setBaud(uint32_t rate);
+
+    // time it took the chip to become ready in the last reset() or wakeup() in ms
+    uint32_t boot_time();
+
+    // wait for network registration, reacts to +CREG reports and asks with increasing backoff
     bool registerNetwork(uint16_t timeout = SIM800_CMD_TIMEOUT);
 
-    // enable GPRS
+    // true if the chip is registered to the home network or roaming (as last reported)
+    bool registered();
+
+    // called when the registration status, location area or cell changes
+    void onRegistration(sim800_registration_handler_t handler);
+
+    // enable GPRS, only does what is missing if the bearer is already (partially) up
     bool enableGPRS(uint16_t timeout = SIM800_CMD_TIMEOUT);
 
     // disable GPRS
     bool disableGPRS();
 
-    // get time off the SIM800 RTC
+    // get time off the SIM800 RTC, date (yy/MM/dd) and time (hh:mm:ss) need 9 bytes, tz (+zz) 4 bytes
     bool time(char *date, char *time, char *tz);
 
+    // the IMEI needs 16 bytes
     bool IMEI(char *imei);
 
     // query battery status, percentage full and voltage
     bool battery(uint16_t &bat_status, uint16_t &bat_percent, uint16_t &bat_voltage);
 
     // query approximate GPS location
-    bool location(char *&lat, char *&lon, char *&date, char *&time);
+    bool location(sim800_location_t &location);
 
-    // query status of the network connection
+    // query status of the network connection (link 0)
     bool status();
 
-    // connect a pure network connection, may send() data after it is opened
+    // query status of a network connection, true if it is connected
+    bool status(uint8_t link);
+
+    // connect a pure network connection (link 0), may send() data after it is opened
     bool connect(const char *address, unsigned short int port, uint16_t timeout = SIM800_CMD_TIMEOUT);
 
-    // disconnect a pure network connection
+    // connect a pure network connection on the given link (0-5), other links stay open
+    bool connect(uint8_t link, const char *address, unsigned short int port, uint16_t timeout = SIM800_CMD_TIMEOUT);
+
+    // open a pure network connection on a free link, returns the link or -1
+    int8_t open(const char *address, unsigned short int port, uint16_t timeout = SIM800_CMD_TIMEOUT);
+
+    // disconnect a pure network connection (link 0)
     bool disconnect();
 
-    // send data down a pure network connection
+    // disconnect the network connection on the given link
+    // all calls that take a link fail (false or 0) for a link >= SIM800_LINKS without using the chip
+    bool disconnect(uint8_t link);
+
+    // true if the chip signalled that data is waiting on the link
+    bool available(uint8_t link);
+
+    // send data down a pure network connection (link 0), waits until the chip accepted it,
+    // accepted is the number of bytes of this call the chip accepted, true if it took all of them
     bool send(char *buffer, size_t size, unsigned long int &accepted);
 
+    // send data down the network connection on the given link, does not wait for the chip to accept it
+    // waits if more than SIM800_SEND_WINDOW bytes are in flight, accepted is the number of bytes of
+    // this call the chip accepted so far (see send_flush() and tx_accepted())
+    bool send(uint8_t link, char *buffer, size_t size, unsigned long int &accepted);
+
+    // send the data read from the stream until it ends, e.g. a UbirchSIM800Compressor
+    // reads blocks of the transfer buffer size
+    bool send(uint8_t link, STREAM &file, unsigned long int &accepted);
+
+    // send the data the writer produces, it is counted first and then written straight to the chip
+    bool send(uint8_t link, sim800_writer_t writer, void *ctx, unsigned long int &accepted);
+
+    // bytes the chip accepted on the link since it was connected
+    uint32_t tx_accepted(uint8_t link);
+
+    // wait until the chip accepted all data sent on the link
+    bool send_flush(uint8_t link, uint16_t timeout = SIM800_SEND_TIMEOUT);
+
+    // query the bytes sent, acknowledged and not yet acknowledged by the remote side (AT+CIPACK)
+    bool acknowledged(uint8_t link, unsigned long int &sent, unsigned long int &acked, unsigned long int &nacked);
+
+    // receive data from a pure network connection (link 0)
     size_t receive(char *buffer, size_t size);
 
+    // receive data from the network connection on the given link, waits up to timeout for data
+    // to arrive and returns what is available (up to size), reads chunks of up to SIM800_RX_CHUNK bytes
+    size_t receive(uint8_t link, char *buffer, size_t size, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
+
+    // connect a single TCP connection in transparent mode, returns the stream to read from and write to
+    // the serial line is reserved for the data until disconnectTransparent(), all other links are closed,
+    // commands are refused and poll() leaves the input alone in the meantime
+    Stream *connectTransparent(const char *address, unsigned short int port, uint16_t timeout = SIM800_CMD_TIMEOUT);
+
+    // leave transparent mode (+++) and close the connection
+    bool disconnectTransparent();
+
     /**
      * HTTP requests only handle data up to 319488 bytes
      * This seems to be a limitation of the chip, a
@@ -126,8 +473,25 @@ public:
     unsigned short int HTTP_get(const char *url, unsigned long int &length);
 
     // HTTP GET request, stores the received data in the stream (if length is > 0)
+    // reads chunks of the transfer buffer size (SIM800_HTTP_CHUNK, see setBuffer())
     unsigned short int HTTP_get(const char *url, unsigned long int &length, STREAM &file);
 
+    // resumable HTTP GET, appends to the stream from progress.offset on, the file is requested in ranges
+    // (Range header) so it may be larger than the chip limit, if the connection drops GPRS is brought
+    // up again and the download continues where it stopped, returns 200 when the download is complete,
+    // otherwise the status or error of the last request (call again with the same progress to resume)
+    unsigned short int HTTP_download(const char *url, sim800_download_t &progress, STREAM &file,
+                                     sim800_download_handler_t handler = NULL, void *ctx = NULL,
+                                     uint32_t range = SIM800_HTTP_RANGE);
+
+    // use the given buffer for streamed transfers instead of the built-in one (SIM800_HTTP_CHUNK bytes)
+    // build with -DSIM800_NO_ARENA to leave the built-in one out, streamed transfers then need a
+    // buffer set here, without one they return 1006 (send() returns false)
+    void setBuffer(char *buffer, size_t size);
+
+    // throughput of the last streamed HTTP transfer (download or upload) in bytes/s
+    uint32_t transfer_rate();
+
     // manually read the payload after a request, returns the amount read, call multiple times to read whole
     size_t HTTP_read(char *buffer, uint32_t start, size_t length);
 
@@ -138,9 +502,43 @@ public:
     unsigned short int HTTP_post(const char *url, unsigned long int &length, char *buffer, uint32_t size);
 
     // HTTP HTTP_post request, reads the data from the stream and returns the result
+    // the data is sent in blocks of the transfer buffer size, exactly size bytes are read
     unsigned short int HTTP_post(const char *url, unsigned long int &length, STREAM &file, uint32_t size);
 
-    // send a command (without AT) and expect it to return a certain string
+    // HTTP HTTP_post request, the body is produced by the writer (e.g. a UbirchSIM800CBOR encoder),
+    // it is run once to count the bytes for AT+HTTPDATA and once to write them to the chip
+    unsigned short int HTTP_post(const char *url, unsigned long int &length, sim800_writer_t writer, void *ctx);
+
+    // terminate the HTTP session, the next request initializes the HTTP service again
+    bool HTTP_end();
+
+    // queue a command (without AT) for asynchronous execution, completes on expected (NULL for OK)
+    // param is appended to the command (e.g. "=2,1") and must stay valid until the command is sent
+    // returns false if the queue is full or a transparent connection is open
+    bool queue_AT(const __FlashStringHelper *cmd, const __FlashStringHelper *expected = NULL,
+                  sim800_callback_t callback = NULL, void *ctx = NULL, uint16_t timeout = SIM800_SERIAL_TIMEOUT,
+                  const char *param = NULL);
+
+    // advance the asynchronous command engine, call from loop(), returns true while commands are pending
+    bool poll();
+
+    // statistics since the last reset
+    const sim800_stats_t &stats();
+
+    // copy the statistics, e.g. to add them to a telemetry post, and start over if reset is set
+    void stats(sim800_stats_t &snapshot, bool reset = true);
+
+    void resetStats();
+
+    // called while blocking calls wait for the chip, must not call back into this class
+    void setIdleCallback(void (*idle)());
+
+    // register a handler for an unsolicited result code (SIM800_URC_*), NULL removes it
+    // handlers run while other calls wait for the chip, so they should only record the event
+    void onURC(uint8_t urc, sim800_urc_handler_t handler);
+
+    // send a command (without AT) and expect it to return a certain string, the command runs
+    // through the queue, other blocking calls wait for the queue and then use the serial line directly
     bool expect_AT(const __FlashStringHelper *cmd, const __FlashStringHelper *expected,
                    uint16_t timeout = SIM800_SERIAL_TIMEOUT);
 
@@ -154,19 +552,22 @@ public:
     bool expect_OK(uint16_t timeout = SIM800_SERIAL_TIMEOUT);
 
 
-    // expect a certain pattern with one value to be returned, ref is a pointer to the value
-    bool expect_scan(const __FlashStringHelper *pattern, void *ref,
-                     uint16_t timeout = SIM800_SERIAL_TIMEOUT);
+    // expect a line starting with the prefix, returns the rest of the line to parse the fields
+    // or NULL if another line was received
+    const char *expect_prefix(const __FlashStringHelper *prefix, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
+
+    // expect "<prefix><n>[,<n>[,<n>]]" and return the numbers
+    bool expect_numbers(const __FlashStringHelper *prefix, uint32_t &n,
+                        uint16_t timeout = SIM800_SERIAL_TIMEOUT);
 
-    // expect a certain pattern with two values to be returned, ref, ref1 are pointer to the values
-    bool expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1,
-                     uint16_t timeout = SIM800_SERIAL_TIMEOUT);
+    bool expect_numbers(const __FlashStringHelper *prefix, uint32_t &n, uint32_t &n1,
+                        uint16_t timeout = SIM800_SERIAL_TIMEOUT);
 
-    bool expect_scan(const __FlashStringHelper *pattern, void *ref, void *ref1, void *ref2,
-                     uint16_t timeout = SIM800_SERIAL_TIMEOUT);
+    bool expect_numbers(const __FlashStringHelper *prefix, uint32_t &n, uint32_t &n1, uint32_t &n2,
+                        uint16_t timeout = SIM800_SERIAL_TIMEOUT);
 
-    // read raw data
-    size_t read(char *buffer, size_t length);
+    // read raw data, gives up if no data arrives within the timeout and returns what was read
+    size_t read(char *buffer, size_t length, uint16_t timeout = SIM800_SERIAL_TIMEOUT);
 
     // read a single line into the given buffer
     size_t readline(char *buffer, size_t max, uint16_t timeout);
@@ -185,58 +586,193 @@ public:
 
     void println(uint32_t s);
 
-#ifdef __AVR__
-    SoftwareSerial _serial = SoftwareSerial(SIM800_TX, SIM800_RX);
+#ifdef SIM800_TRACE
+    UbirchSIM800Trace _serial = UbirchSIM800Trace(SIM800_SERIAL_INIT);
+
+    // write the recorded serial traffic (binary, see UbirchSIM800Trace.h) and start over if clear is set
+    void dumpTrace(Print &out, bool clear = true);
 #else
-    HardwareSerial2 _serial = Serial2;
+    SIM800_SERIAL_TYPE _serial = SIM800_SERIAL_INIT;
 #endif
 
 protected:
-    const uint32_t _serialSpeed = SIM800_BAUD;
+    uint32_t _serialSpeed = SIM800_BAUD;
     const __FlashStringHelper *_apn;
     const __FlashStringHelper *_user;
     const __FlashStringHelper *_pass;
+    uint32_t _transfer_rate = 0;
+    uint32_t _boot_time = 0;
+
+    // wait until the chip answers after power on or reset and configure it
+    bool boot();
+
+    // check that the chip reports the baud rate we are using
+    bool verify_baud();
+
+    // find the baud rate the chip is fixed to if it does not answer at the configured one
+    bool detect_baud();
+
+    // network registration as reported by +CREG
+    uint8_t _creg = 0;
+    uint16_t _lac = 0;
+    uint16_t _ci = 0;
+    sim800_registration_handler_t _creg_handler = NULL;
+
+    // TCP/IP state, the IP connection is brought up once and shared by all links
+    bool _ip_up = false;
+    uint8_t _links = 0;    // open links
+    uint8_t _links_rx = 0; // links with data waiting
+    uint32_t _tx_sent[SIM800_LINKS] = {};     // bytes handed to the chip per link
+    uint32_t _tx_accepted[SIM800_LINKS] = {}; // bytes the chip accepted per link (DATA ACCEPT)
+
+    // bytes accepted of the data sent on the link since _tx_sent was start
+    uint32_t accepted_since(uint8_t link, uint32_t start);
+
+    // bring up the IP connection used by the links if it is not up yet, continues where the chip is
+    bool ip_up(uint16_t timeout);
+
+    // start the task (CSTT), bring up the wireless connection (CIICR) and wait for an IP address,
+    // beginning at the given stage (SIM800_IP_*)
+    bool ip_start(uint16_t timeout, uint8_t stage);
+
+    // GPRS bearer state, dropped by +PDP: DEACT and +SAPBR 1: DEACT
+    bool _bearer_up = false;
+    bool _bearer_configured = false;
 
-    // eat input until no more is available, basically sucks up echos and left over status messages
+    // query the bearer status (AT+SAPBR=2,1), true if it is connected
+    bool bearer_up();
+
+    // query if GPRS is attached (AT+CGATT?)
+    bool gprs_attached();
+
+    // transparent mode state
+    bool _transparent = false;
+    UbirchSIM800Stream _transparent_stream = UbirchSIM800Stream(*this);
+
+    // wait for room in the send window, announce a block (AT+CIPSEND) and wait for the prompt
+    bool send_prompt(uint8_t link, size_t block);
+
+    // expect a report for the link ("<link>, <expected>"), reports of other links are skipped
+    bool expect_link(uint8_t link, const __FlashStringHelper *expected, uint16_t timeout);
+
+    // HTTP session, the service is initialized once and the URL is only sent if it changed
+    bool _http_init = false;
+    char _http_url[SIM800_HTTP_URL] = "";
+
+    // buffer for streamed transfers, the built-in arena of SIM800_HTTP_CHUNK bytes if not set
+    char *_buffer = NULL;
+    size_t _buffer_size = 0;
+
+    // the buffer for streamed transfers, NULL if there is none (SIM800_NO_ARENA)
+    char *transfer_buffer(size_t &size);
+
+    // initialize the HTTP session if necessary and set the URL, returns 0 or an error code
+    unsigned short int HTTP_session(const char *url);
+
+    // terminate the session after an error and return the error code
+    unsigned short int HTTP_abort(unsigned short int error);
+
+    // announce the upload of size bytes, returns true when the chip is ready to receive
+    bool HTTP_data(uint32_t size);
+
+    // run the HTTP action (0 = GET, 1 = POST) and wait for the result, returns the status
+    unsigned short int HTTP_action(uint8_t method, unsigned long int &length);
+
+    // read length bytes of the response from start on into the stream, updates crc if given, a failed
+    // read is repeated with half the chunk size (down to SIM800_BUFSIZE), returns the number of bytes copied
+    uint32_t HTTP_copy(STREAM &file, uint32_t start, uint32_t length, uint32_t *crc = NULL);
+
+    // statistics and the command waiting for its final result
+    sim800_stats_t _stats = {};
+    sim800_command_stats_t *_stats_cmd = NULL;
+    unsigned long _stats_started = 0;
+    bool _stats_in_line = false;
+
+    // count a command (without AT) that is sent to the chip
+    void stats_command(const char *cmd, bool progmem);
+
+    // check a command line that is printed, the first part of a line starts a command
+    void stats_print(const char *s, bool progmem);
+
+    // record the latency if the current line is a final result
+    void stats_result();
+
+    // the command did not get an answer in time
+    void stats_timeout();
+
+    struct command {
+        const __FlashStringHelper *cmd;
+        const char *param;
+        const __FlashStringHelper *expected;
+        sim800_callback_t callback;
+        void *ctx;
+        uint16_t timeout;
+    };
+
+    command _queue[SIM800_QUEUE_SIZE];
+    uint8_t _queue_head = 0;
+    uint8_t _queue_len = 0;
+    bool _queue_active = false;
+    uint8_t _queue_result = SIM800_EVENT_OK;
+    unsigned long _queue_started = 0;
+
+    // receive buffer, lines are handed out as views into it (one extra byte for the terminator)
+    char _rx[SIM800_RXBUFSIZE + 1];
+    uint16_t _rx_start = 0; // first unconsumed byte
+    uint16_t _rx_end = 0;   // end of the buffered input
+    uint16_t _rx_scan = 0;  // where the tokenizer continues looking for the end of a line
+    uint16_t _rx_next = 0;  // first byte after the current line
+
+    // the current line, points into the receive buffer and is valid until the next line is requested
+    char *_line = _rx;
+    uint16_t _line_len = 0;
+    bool _line_ready = false;
+
+    void (*_idle)() = NULL;
+
+    sim800_urc_handler_t _urc_handlers[SIM800_URC_COUNT] = {};
+
+    // before a command is sent: handle waiting URCs and drop left over status messages
     void eat_echo();
 
-    bool is_urc(const char *line, size_t len);
-};
+    // collect available input without blocking, returns true if a complete line is in _line
+    // (command echos are skipped)
+    bool poll_line();
 
-// this useful list found here: https://github.com/cloudyourcar/attentive
+    // hand out the buffered input up to end as the current line
+    bool take_line(uint16_t end);
+
+    // number of buffered and pending input bytes
+    int rx_available();
+
+    // read (or peek at) the next input byte, buffered input first
+    int rx_read(bool consume);
+
+    // process waiting unsolicited result codes and drop other complete lines (unless commands are queued)
+    void poll_urc();
+
+    // drop buffered and pending input
+    void rx_clear();
+
+    // block until a line is available or the timeout hits, returns the length of _line
+    size_t wait_line(uint16_t timeout);
+
+    // finish the active command with the given event
+    void complete(uint8_t event);
+
+    // wait for all queued commands to finish
+    void flush_queue();
+
+    // give the application some time while we are waiting
+    void idle();
+
+    // wait the given time while keeping the application running
+    void sleep(uint16_t ms);
+
+    bool is_urc(const char *line, size_t len);
 
-/* incoming socket data notification */
-const char * const urc_01 PROGMEM = "+CIPRXGET: 1,";
-/* FTP state change notification */
-const char * const urc_02 PROGMEM = "+FTPGET: 1,";
-/* PDP disconnected */
-const char * const urc_03 PROGMEM = "+PDP: DEACT";
-/* PDP disconnected (for SAPBR apps) */
-const char * const urc_04 PROGMEM = "+SAPBR 1: DEACT";
-/* AT+CLTS network name */
-const char * const urc_05 PROGMEM = "*PSNWID:";
-/* AT+CLTS time */
-const char * const urc_06 PROGMEM = "*PSUTTZ:";
-/* AT+CLTS timezone */
-const char * const urc_07 PROGMEM = "+CTZV:";
-/* AT+CLTS dst information */
-const char * const urc_08 PROGMEM = "DST:";
-/* AT+CLTS undocumented indicator */
-const char * const urc_09 PROGMEM = "+CIEV:";
-/* Assorted crap on newer firmware releases. */
-const char * const urc_10 PROGMEM = "RDY";
-const char * const urc_11 PROGMEM = "+CPIN: READY";
-const char * const urc_12 PROGMEM = "Call Ready";
-const char * const urc_13 PROGMEM = "SMS Ready";
-const char * const urc_14 PROGMEM = "NORMAL POWER DOWN";
-const char * const urc_15 PROGMEM = "UNDER-VOLTAGE POWER DOWN";
-const char * const urc_16 PROGMEM = "UNDER-VOLTAGE WARNNING";
-const char * const urc_17 PROGMEM = "OVER-VOLTAGE POWER DOWN";
-const char * const urc_18 PROGMEM = "OVER-VOLTAGE WARNNING";
-
-const char * const _urc_messages[] PROGMEM = {
-        urc_01, urc_02, urc_03, urc_04, urc_06, urc_07, urc_08, urc_09, urc_10,
-        urc_11, urc_12, urc_13, urc_14, urc_15, urc_16, urc_17, urc_18
+    // keep internal state in sync with unsolicited result codes
+    void handle_urc(uint8_t urc, const char *line, size_t len);
 };
 
 #endif //UBIRCH_SIM800_H
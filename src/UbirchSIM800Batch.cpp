@@ -0,0 +1,301 @@
+/**
+ * UbirchSIM800Batch queues payloads and uploads them in batches so
+ * the SIM800 is only woken up when it is worth the energy.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Arduino.h>
+#include "UbirchSIM800Batch.h"
+
+#if defined(TEENSYDUINO)
+#define Serial      Serial1
+#endif
+
+#ifndef NDEBUG
+#   define PRINT(s) Serial.print(F(s))
+#   define PRINTLN(s) Serial.println(F(s))
+#   define DEBUG(...) Serial.print(__VA_ARGS__)
+#   define DEBUGLN(...) Serial.println(__VA_ARGS__)
+#else
+#   define PRINT(s)
+#   define PRINTLN(s)
+#   define DEBUG(...)
+#   define DEBUGLN(...)
+#endif
+
+#define SIM800_BATCH_BLOCK 16
+
+// reads a payload from the store, used as the body of a POST
+class UbirchSIM800BatchStream : public Stream {
+public:
+  UbirchSIM800BatchStream(UbirchSIM800Batch &batch, uint32_t pos, size_t size)
+      : _batch(batch), _pos(pos), _end(pos + size) { }
+
+  virtual int available() {
+    return (int) min(_end - _pos + (_block_len - _block_pos), (uint32_t) 0x7fff);
+  }
+
+  virtual int read() {
+    return fill() ? _block[_block_pos++] : -1;
+  }
+
+  virtual int peek() {
+    return fill() ? _block[_block_pos] : -1;
+  }
+
+  virtual void flush() { }
+
+  virtual size_t write(uint8_t) {
+    return 0;
+  }
+
+  using Print::write;
+
+private:
+  UbirchSIM800Batch &_batch;
+  uint32_t _pos;
+  uint32_t _end;
+  uint8_t _block[SIM800_BATCH_BLOCK];
+  uint8_t _block_pos = 0;
+  uint8_t _block_len = 0;
+
+  bool fill() {
+    if (_block_pos < _block_len) return true;
+    if (_pos == _end) return false;
+
+    uint8_t n = (uint8_t) min((uint32_t) SIM800_BATCH_BLOCK, _end - _pos);
+    if (!_batch.store_read(_pos, _block, n)) return false;
+    _pos += n;
+    _block_pos = 0;
+    _block_len = n;
+    return true;
+  }
+};
+
+UbirchSIM800Batch::UbirchSIM800Batch(UbirchSIM800 &sim800, const char *url) : _sim800(sim800), _url(url) { }
+
+void UbirchSIM800Batch::setThresholds(size_t size, uint32_t age, uint8_t priority) {
+  _threshold = size;
+  _max_age = age;
+  _priority = priority;
+}
+
+void UbirchSIM800Batch::setStore(UbirchSIM800Storage *store) {
+  // the payloads in the previous store are given up, only the RAM queue is left
+  uint16_t pending = _pending;
+  _store = store;
+  _store_head = _store_tail = 0;
+  recount();
+  _stats.dropped += pending - _pending;
+}
+
+bool UbirchSIM800Batch::add(const char *payload, size_t size, uint8_t priority) {
+  char header[SIM800_BATCH_HEADER] = {(char) (size & 0xff), (char) (size >> 8), (char) priority};
+
+  if (size > 0xffff) {
+    _stats.dropped++;
+    return false;
+  }
+
+  if (_store) {
+    if (_store_tail - _store_head + SIM800_BATCH_HEADER + size > _store->size() ||
+        !store_write(_store_tail, (const uint8_t *) header, SIM800_BATCH_HEADER) ||
+        !store_write(_store_tail + SIM800_BATCH_HEADER, (const uint8_t *) payload, size)) {
+      _stats.dropped++;
+      return false;
+    }
+    _store_tail += SIM800_BATCH_HEADER + size;
+  } else {
+    if (_queue_len + SIM800_BATCH_HEADER + size > SIM800_BATCH_SIZE) {
+      _stats.dropped++;
+      return false;
+    }
+    memcpy(_queue + _queue_len, header, SIM800_BATCH_HEADER);
+    memcpy(_queue + _queue_len + SIM800_BATCH_HEADER, payload, size);
+    _queue_len += SIM800_BATCH_HEADER + size;
+  }
+
+  if (!_pending) _oldest = millis();
+  _newest = millis();
+  count(priority, size);
+  return true;
+}
+
+bool UbirchSIM800Batch::due() {
+  if (!_pending) return false;
+  if (_retry && millis() - _retry_since < SIM800_BATCH_RETRY) return false;
+  return _pending_bytes >= _threshold || millis() - _oldest >= _max_age || _pending_priority >= _priority;
+}
+
+uint16_t UbirchSIM800Batch::run() {
+  return due() ? flush() : 0;
+}
+
+uint16_t UbirchSIM800Batch::flush(uint16_t timeout) {
+  if (!_pending) return 0;
+
+  PRINT("!!! BATCH upload ");
+  DEBUG(_pending);
+  PRINTLN(" payloads");
+
+  unsigned long started = millis();
+  uint16_t sent = 0;
+  // one session for the whole batch, the bearer and the HTTP session are reused for every payload
+  if (_sim800.wakeup() && _sim800.registerNetwork(timeout) && _sim800.enableGPRS(timeout)) {
+    sent = drain();
+  } else {
+    _stats.failed++;
+  }
+  _sim800.shutdown();
+
+  _stats.sessions++;
+  _stats.last_sent = sent;
+  _stats.last_time = millis() - started;
+  _stats.on_time += _stats.last_time;
+
+  // what is left waits a while instead of waking the chip up again right away
+  _retry = _pending != 0;
+  _retry_since = millis();
+
+  PRINT("!!! BATCH sent ");
+  DEBUG(sent);
+  PRINT(" in ");
+  DEBUG(_stats.last_time);
+  PRINTLN("ms");
+  return sent;
+}
+
+uint16_t UbirchSIM800Batch::drain() {
+  uint16_t sent = 0, pending = _pending;
+
+  // payloads in RAM go first, they may be left over from before the store was set
+  size_t pos = 0;
+  bool ok = true;
+  while (pos < _queue_len) {
+    size_t size = (uint8_t) _queue[pos] | ((uint8_t) _queue[pos + 1] << 8);
+    uint16_t status = post(_queue + pos + SIM800_BATCH_HEADER, size);
+    if (!(ok = settle(status, size))) break;
+    pos += SIM800_BATCH_HEADER + size;
+    if (status < 300) sent++;
+  }
+  memmove(_queue, _queue + pos, _queue_len - pos);
+  _queue_len -= pos;
+
+  // the payloads in the store are posted from where they are, a payload that
+  // could not be delivered stays at the head for the next session
+  while (ok && _store && _store_head != _store_tail) {
+    uint8_t header[SIM800_BATCH_HEADER];
+    if (!store_read(_store_head, header, SIM800_BATCH_HEADER)) break;
+    size_t size = header[0] | (header[1] << 8);
+    uint16_t status = post(_store_head + SIM800_BATCH_HEADER, size);
+    if (!(ok = settle(status, size))) break;
+    _store_head += SIM800_BATCH_HEADER + size;
+    if (status < 300) sent++;
+  }
+  // keep the positions small so they never overflow
+  if (_store && _store_head >= _store->size()) {
+    _store_head -= _store->size();
+    _store_tail -= _store->size();
+  }
+
+  // the oldest payload left was queued by the time of the last add() at the latest
+  recount();
+  if (_pending && _pending != pending) _oldest = _newest;
+  return sent;
+}
+
+uint16_t UbirchSIM800Batch::post(char *payload, size_t size) {
+  unsigned long int length;
+  return _sim800.HTTP_post(_url, length, payload, size);
+}
+
+uint16_t UbirchSIM800Batch::post(uint32_t pos, size_t size) {
+  UbirchSIM800BatchStream body(*this, pos, size);
+  unsigned long int length;
+  return _sim800.HTTP_post(_url, length, body, size);
+}
+
+bool UbirchSIM800Batch::store_read(uint32_t pos, uint8_t *buffer, size_t length) {
+  uint32_t ring = _store->size(), offset = pos % ring;
+  size_t first = (size_t) min((uint32_t) length, ring - offset);
+  if (!_store->read(offset, buffer, first)) return false;
+  return first == length || _store->read(0, buffer + first, length - first);
+}
+
+bool UbirchSIM800Batch::store_write(uint32_t pos, const uint8_t *buffer, size_t length) {
+  uint32_t ring = _store->size(), offset = pos % ring;
+  size_t first = (size_t) min((uint32_t) length, ring - offset);
+  if (!_store->write(offset, buffer, first)) return false;
+  return first == length || _store->write(0, buffer + first, length - first);
+}
+
+bool UbirchSIM800Batch::settle(uint16_t status, size_t size) {
+  if (status >= 200 && status < 300) {
+    _stats.payloads++;
+    _stats.bytes += size;
+  } else if (status >= 400 && status < 500) {
+    // the server will not take it, sending it again would not change that
+    PRINT("!!! BATCH refused ");
+    DEBUGLN(status);
+    _stats.dropped++;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void UbirchSIM800Batch::recount() {
+  _pending = 0;
+  _pending_bytes = 0;
+  _pending_priority = 0;
+
+  size_t size;
+  for (size_t pos = 0; pos < _queue_len; pos += SIM800_BATCH_HEADER + size) {
+    size = (uint8_t) _queue[pos] | ((uint8_t) _queue[pos + 1] << 8);
+    count((uint8_t) _queue[pos + 2], size);
+  }
+  for (uint32_t pos = _store_head; _store && pos < _store_tail; pos += SIM800_BATCH_HEADER + size) {
+    uint8_t header[SIM800_BATCH_HEADER];
+    if (!store_read(pos, header, SIM800_BATCH_HEADER)) break;
+    size = header[0] | (header[1] << 8);
+    count(header[2], size);
+  }
+}
+
+void UbirchSIM800Batch::count(uint8_t priority, size_t size) {
+  _pending++;
+  _pending_bytes += size;
+  if (priority > _pending_priority) _pending_priority = priority;
+}
+
+uint16_t UbirchSIM800Batch::pending() {
+  return _pending;
+}
+
+uint32_t UbirchSIM800Batch::pending_bytes() {
+  return _pending_bytes;
+}
+
+const sim800_batch_stats_t &UbirchSIM800Batch::stats() {
+  return _stats;
+}
+
+uint32_t UbirchSIM800Batch::on_time_per_payload() {
+  return _stats.payloads ? _stats.on_time / _stats.payloads : 0;
+}
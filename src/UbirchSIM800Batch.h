@@ -0,0 +1,157 @@
+/**
+ * UbirchSIM800Batch queues payloads and uploads them in batches so
+ * the SIM800 is only woken up when it is worth the energy.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UBIRCH_SIM800_BATCH_H
+#define UBIRCH_SIM800_BATCH_H
+
+#include "UbirchSIM800.h"
+#include "UbirchSIM800Log.h"
+
+// the settings may be overridden with build flags, SIM800_BATCH_SIZE changes the size of
+// UbirchSIM800Batch and must be the same for all sources (-DSIM800_BATCH_SIZE=1024)
+#ifndef SIM800_BATCH_SIZE
+#ifdef __AVR__
+#define SIM800_BATCH_SIZE 512
+#else
+#define SIM800_BATCH_SIZE 4096
+#endif
+#endif
+// default thresholds: upload when half the queue is full, the oldest payload
+// waited for an hour or a payload with at least this priority is queued
+#ifndef SIM800_BATCH_THRESHOLD
+#define SIM800_BATCH_THRESHOLD (SIM800_BATCH_SIZE / 2)
+#endif
+#ifndef SIM800_BATCH_AGE
+#define SIM800_BATCH_AGE 3600000UL
+#endif
+#ifndef SIM800_BATCH_PRIORITY
+#define SIM800_BATCH_PRIORITY 255
+#endif
+// wait before retrying after a session could not upload everything
+#ifndef SIM800_BATCH_RETRY
+#define SIM800_BATCH_RETRY 300000UL
+#endif
+// queued payloads are prefixed with their size (2 bytes) and priority (1 byte)
+#define SIM800_BATCH_HEADER 3
+
+// statistics of the batch uploads, used to tune the thresholds
+struct sim800_batch_stats_t {
+    uint32_t sessions;  // modem sessions (wakeup to shutdown)
+    uint32_t failed;    // sessions that could not reach the network
+    uint32_t payloads;  // payloads uploaded
+    uint32_t bytes;     // payload bytes uploaded
+    uint32_t dropped;   // payloads lost (queue full or refused by the server with a 4xx)
+    uint32_t on_time;   // total modem on time in ms
+    uint32_t last_time; // modem on time of the last session in ms
+    uint16_t last_sent; // payloads uploaded in the last session
+};
+
+class UbirchSIM800Batch {
+    friend class UbirchSIM800BatchStream;
+
+public:
+    UbirchSIM800Batch(UbirchSIM800 &sim800, const char *url);
+
+    // upload when size bytes are pending, the oldest payload is age ms old or a
+    // payload with at least the given priority is queued
+    void setThresholds(size_t size, uint32_t age, uint8_t priority = SIM800_BATCH_PRIORITY);
+
+    // keep queued payloads in a storage region (EEPROM, FRAM, a file) instead of RAM, used as a
+    // ring with its own read and write position, NULL switches back to the RAM queue
+    // the positions are kept in RAM, use UbirchSIM800Log for payloads that must survive a reset,
+    // payloads left in a previous store are dropped
+    void setStore(UbirchSIM800Storage *store);
+
+    // queue a payload, returns false if there is no room for it
+    bool add(const char *payload, size_t size, uint8_t priority = 0);
+
+    // true if one of the thresholds is reached (and a failed session is not too recent)
+    bool due();
+
+    // call from loop(), uploads the batch if it is due, returns the number of payloads sent
+    uint16_t run();
+
+    // wake up the chip, upload all pending payloads in one session and shut it down again
+    // payloads refused with a 4xx are dropped, the others that could not be sent stay
+    // queued, returns the number of payloads sent
+    uint16_t flush(uint16_t timeout = SIM800_CMD_TIMEOUT);
+
+    // number of queued payloads and their size
+    uint16_t pending();
+    uint32_t pending_bytes();
+
+    // upload statistics
+    const sim800_batch_stats_t &stats();
+
+    // average modem on time per uploaded payload in ms
+    uint32_t on_time_per_payload();
+
+protected:
+    UbirchSIM800 &_sim800;
+    const char *_url;
+
+    // the store ring, payloads between head and tail, positions wrap around its size
+    UbirchSIM800Storage *_store = NULL;
+    uint32_t _store_head = 0;
+    uint32_t _store_tail = 0;
+
+    size_t _threshold = SIM800_BATCH_THRESHOLD;
+    uint32_t _max_age = SIM800_BATCH_AGE;
+    uint8_t _priority = SIM800_BATCH_PRIORITY;
+
+    // RAM queue, payloads one after the other, each prefixed with its header
+    char _queue[SIM800_BATCH_SIZE];
+    size_t _queue_len = 0;
+
+    // state of the payloads waiting in RAM and the store
+    uint16_t _pending = 0;
+    uint32_t _pending_bytes = 0;
+    uint8_t _pending_priority = 0;
+    unsigned long _oldest = 0;
+    unsigned long _newest = 0;
+    bool _retry = false;
+    unsigned long _retry_since = 0;
+
+    sim800_batch_stats_t _stats = {};
+
+    // upload the payloads from RAM, then from the store, stops at the first payload
+    // that has to be retried (transport error or 5xx)
+    uint16_t drain();
+
+    // upload a single payload, returns the HTTP status
+    uint16_t post(char *payload, size_t size);
+    uint16_t post(uint32_t pos, size_t size);
+
+    // read and write the store at a ring position
+    bool store_read(uint32_t pos, uint8_t *buffer, size_t length);
+    bool store_write(uint32_t pos, const uint8_t *buffer, size_t length);
+
+    // account for a posted payload, true if it is done with (2xx uploaded, 4xx dropped)
+    // and false if it has to stay queued
+    bool settle(uint16_t status, size_t size);
+
+    // count the payloads left in RAM and the store again, their size and highest priority
+    void recount();
+    void count(uint8_t priority, size_t size);
+};
+
+#endif //UBIRCH_SIM800_BATCH_H
@@ -0,0 +1,149 @@
+/**
+ * UbirchSIM800CBOR is a small CBOR (RFC 7049) encoder that writes into
+ * a buffer or a Print without using the heap. Without a target it only
+ * counts the bytes, to announce the size of an upload up front.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UBIRCH_SIM800_CBOR_H
+#define UBIRCH_SIM800_CBOR_H
+
+#include <string.h>
+#include "UbirchSIM800.h"
+
+// CBOR major types
+#define CBOR_UINT   0
+#define CBOR_NINT   1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_SIMPLE 7
+
+// encode a message the same way with a counting encoder and the real one:
+//   void encode(Print &out, void *ctx) {
+//     UbirchSIM800CBOR cbor(out);
+//     cbor.map(2);
+//     cbor.text("t"); cbor.number(21.5f);
+//     cbor.text("bat"); cbor.uint(3712);
+//   }
+//   sim800.HTTP_post(url, length, encode, NULL);
+class UbirchSIM800CBOR {
+public:
+    // count only
+    UbirchSIM800CBOR() { }
+
+    // write into the buffer, overflow() is set if it is too small
+    UbirchSIM800CBOR(uint8_t *buffer, size_t size) : _buffer(buffer), _capacity(size) { }
+
+    // write to the output (the serial line, a file, a counter)
+    UbirchSIM800CBOR(Print &out) : _out(&out) { }
+
+    // a map with the given number of key/value pairs follows
+    void map(uint32_t pairs) { head(CBOR_MAP, pairs); }
+
+    // an array with the given number of items follows
+    void array(uint32_t items) { head(CBOR_ARRAY, items); }
+
+    void uint(uint32_t value) { head(CBOR_UINT, value); }
+
+    void integer(int32_t value) {
+        if (value < 0) head(CBOR_NINT, (uint32_t) (-1 - value));
+        else head(CBOR_UINT, (uint32_t) value);
+    }
+
+    // single precision float, doubles on AVR are the same anyway
+    void number(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        put(0xfa);
+        put32(bits);
+    }
+
+    void boolean(bool value) { put(value ? 0xf5 : 0xf4); }
+
+    void null() { put(0xf6); }
+
+    void text(const char *s) { text(s, strlen(s)); }
+
+    void text(const char *s, size_t length) {
+        head(CBOR_TEXT, length);
+        write((const uint8_t *) s, length);
+    }
+
+#ifdef __AVR__
+    void text(const __FlashStringHelper *s) {
+        PGM_P p = reinterpret_cast<PGM_P>(s);
+        size_t length = strlen_P(p);
+        head(CBOR_TEXT, length);
+        while (length--) put(pgm_read_byte(p++));
+    }
+#endif
+
+    void bytes(const uint8_t *data, size_t length) {
+        head(CBOR_BYTES, length);
+        write(data, length);
+    }
+
+    // bytes encoded so far (or that would have been written to the buffer)
+    size_t size() { return _size; }
+
+    // true if the buffer was too small
+    bool overflow() { return _buffer && _size > _capacity; }
+
+private:
+    Print *_out = NULL;
+    uint8_t *_buffer = NULL;
+    size_t _capacity = 0;
+    size_t _size = 0;
+
+    void head(uint8_t major, uint32_t value) {
+        major <<= 5;
+        if (value < 24) {
+            put(major | value);
+        } else if (value <= 0xff) {
+            put(major | 24);
+            put((uint8_t) value);
+        } else if (value <= 0xffff) {
+            put(major | 25);
+            put((uint8_t) (value >> 8));
+            put((uint8_t) value);
+        } else {
+            put(major | 26);
+            put32(value);
+        }
+    }
+
+    void put32(uint32_t value) {
+        put((uint8_t) (value >> 24));
+        put((uint8_t) (value >> 16));
+        put((uint8_t) (value >> 8));
+        put((uint8_t) value);
+    }
+
+    void put(uint8_t c) { write(&c, 1); }
+
+    void write(const uint8_t *data, size_t length) {
+        if (_out) _out->write(data, length);
+        else if (_buffer && _size + length <= _capacity) memcpy(_buffer + _size, data, length);
+        _size += length;
+    }
+};
+
+#endif //UBIRCH_SIM800_CBOR_H
@@ -0,0 +1,119 @@
+/**
+ * UbirchSIM800Compressor compresses a stream on the fly with a small
+ * LZSS window (heatshrink bit format) to reduce the data sent over GPRS.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Arduino.h>
+#include "UbirchSIM800Compressor.h"
+
+#define SIM800_LZ_MASK (SIM800_LZ_WINDOW - 1)
+
+UbirchSIM800Compressor::UbirchSIM800Compressor(Stream &source, uint32_t size)
+    : _source(source), _remaining(size) { }
+
+uint32_t UbirchSIM800Compressor::measure(Stream &source, uint32_t size) {
+  UbirchSIM800Compressor compressor(source, size);
+  uint32_t compressed = 0;
+  while (compressor.read() != -1) compressed++;
+  return compressed;
+}
+
+int UbirchSIM800Compressor::available() {
+  return _bit_count || _in != _pos || _remaining ? 1 : 0;
+}
+
+int UbirchSIM800Compressor::read() {
+  if (!fill()) return -1;
+  _bit_count -= 8;
+  return (uint8_t) (_bits >> _bit_count);
+}
+
+int UbirchSIM800Compressor::peek() {
+  if (!fill()) return -1;
+  return (uint8_t) (_bits >> (_bit_count - 8));
+}
+
+void UbirchSIM800Compressor::flush() { }
+
+size_t UbirchSIM800Compressor::write(uint8_t) {
+  return 0;
+}
+
+void UbirchSIM800Compressor::refill() {
+  // the byte replaced is further back than the longest distance a match may have
+  while (_remaining && _in - _pos < SIM800_LZ_LOOKAHEAD) {
+    int c = _source.read();
+    if (c == -1) {
+      _remaining = 0;
+      break;
+    }
+    _ring[_in++ & SIM800_LZ_MASK] = (uint8_t) c;
+    _remaining--;
+  }
+}
+
+void UbirchSIM800Compressor::push(uint16_t value, uint8_t count) {
+  _bits = (_bits << count) | value;
+  _bit_count += count;
+}
+
+bool UbirchSIM800Compressor::fill() {
+  while (_bit_count < 8) {
+    refill();
+    if (_in == _pos) {
+      if (!_bit_count) return false;
+      // pad the last byte with zeros
+      push(0, (uint8_t) (8 - _bit_count));
+      break;
+    }
+
+    // find the longest match in the window, the nearest one if there are several
+    uint8_t limit = (uint8_t) min(_in - _pos, (uint32_t) SIM800_LZ_LOOKAHEAD);
+    uint16_t distance = (uint16_t) min(_pos, (uint32_t) (SIM800_LZ_WINDOW - SIM800_LZ_LOOKAHEAD));
+    uint8_t first = _ring[_pos & SIM800_LZ_MASK];
+    uint8_t best = 0;
+    uint16_t best_distance = 0;
+    for (uint16_t d = 1; d <= distance && best < limit; d++) {
+      uint32_t from = _pos - d;
+      if (_ring[from & SIM800_LZ_MASK] != first) continue;
+      uint8_t length = 1;
+      while (length < limit && _ring[(from + length) & SIM800_LZ_MASK] == _ring[(_pos + length) & SIM800_LZ_MASK])
+        length++;
+      if (length > best) {
+        best = length;
+        best_distance = d;
+      }
+    }
+
+    if (best >= 2) {
+      // back reference: tag 0, distance - 1, length - 1
+      push(0, 1);
+      push(best_distance - 1, SIM800_LZ_WINDOW_BITS);
+      push(best - 1, SIM800_LZ_LOOKAHEAD_BITS);
+      _pos += best;
+    } else {
+      // literal: tag 1, byte
+      push(1, 1);
+      push(first, 8);
+      _pos++;
+    }
+  }
+  return true;
+}
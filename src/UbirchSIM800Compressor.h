@@ -0,0 +1,99 @@
+/**
+ * UbirchSIM800Compressor compresses a stream on the fly with a small
+ * LZSS window (heatshrink bit format) to reduce the data sent over GPRS.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UBIRCH_SIM800_COMPRESSOR_H
+#define UBIRCH_SIM800_COMPRESSOR_H
+
+#include "UbirchSIM800.h"
+
+// window and lookahead size (as powers of two), decode with heatshrink -d -w <window> -l <lookahead>
+// both may be overridden with build flags, the window changes the size of UbirchSIM800Compressor
+// and must be the same for all sources (-DSIM800_LZ_WINDOW_BITS=8)
+#ifndef SIM800_LZ_WINDOW_BITS
+#ifdef __AVR__
+#define SIM800_LZ_WINDOW_BITS 8
+#else
+#define SIM800_LZ_WINDOW_BITS 10
+#endif
+#endif
+#ifndef SIM800_LZ_LOOKAHEAD_BITS
+#define SIM800_LZ_LOOKAHEAD_BITS 4
+#endif
+// a token has to fit into the bit buffer and a match length into a byte
+#if SIM800_LZ_WINDOW_BITS > 15 || SIM800_LZ_LOOKAHEAD_BITS > 7 || SIM800_LZ_LOOKAHEAD_BITS >= SIM800_LZ_WINDOW_BITS
+#error "SIM800_LZ_WINDOW_BITS must be at most 15 and larger than SIM800_LZ_LOOKAHEAD_BITS (at most 7)"
+#endif
+
+#define SIM800_LZ_WINDOW (1 << SIM800_LZ_WINDOW_BITS)
+#define SIM800_LZ_LOOKAHEAD (1 << SIM800_LZ_LOOKAHEAD_BITS)
+
+// reads size bytes from the source and returns them compressed, the source is read as the
+// compressed data is consumed, so nothing is staged apart from the window
+//
+// AT+HTTPDATA needs the size up front, so uploads take two passes over a source that can be
+// read again (a file, the store-and-forward log):
+//   uint32_t compressed = UbirchSIM800Compressor::measure(file, size);
+//   file.seek(0);
+//   UbirchSIM800Compressor body(file, size);
+//   sim800.HTTP_post(url, length, body, compressed);
+class UbirchSIM800Compressor : public Stream {
+public:
+    UbirchSIM800Compressor(Stream &source, uint32_t size);
+
+    // compress size bytes of the source and return the compressed size
+    static uint32_t measure(Stream &source, uint32_t size);
+
+    virtual int available();
+
+    virtual int read();
+
+    virtual int peek();
+
+    virtual void flush();
+
+    virtual size_t write(uint8_t c);
+
+    using Print::write;
+
+private:
+    Stream &_source;
+    uint32_t _remaining;
+
+    // window and lookahead, positions count all bytes read from the source
+    uint8_t _ring[SIM800_LZ_WINDOW];
+    uint32_t _in = 0;  // bytes read into the ring
+    uint32_t _pos = 0; // next byte to encode
+
+    // bits of the last token not yet returned
+    uint32_t _bits = 0;
+    uint8_t _bit_count = 0;
+
+    // encode tokens until at least one output byte is ready, false at the end of the data
+    bool fill();
+
+    // read ahead from the source to fill the lookahead
+    void refill();
+
+    void push(uint16_t value, uint8_t count);
+};
+
+#endif //UBIRCH_SIM800_COMPRESSOR_H
@@ -0,0 +1,240 @@
+/**
+ * UbirchSIM800Log is a crash-safe store-and-forward queue that keeps
+ * records in a storage region while the network is not available and
+ * forwards them in bulk when it comes back.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Arduino.h>
+#include "UbirchSIM800Log.h"
+
+// CRC-16/CCITT-FALSE, bitwise to keep the flash footprint small
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t length) {
+  while (length--) {
+    crc ^= (uint16_t) *data++ << 8;
+    for (uint8_t i = 0; i < 8; i++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, (uint16_t) v);
+  put16(p + 2, (uint16_t) (v >> 16));
+}
+
+static uint16_t get16(const uint8_t *p) {
+  return p[0] | ((uint16_t) p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+  return get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+UbirchSIM800LogStream::UbirchSIM800LogStream(UbirchSIM800Log &log, uint32_t start, uint32_t end)
+    : _log(log), _pos(start), _end(end) { }
+
+bool UbirchSIM800LogStream::fill() {
+  if (_block_pos < _block_len) return true;
+  if (_pos == _end) return false;
+
+  uint16_t n = (uint16_t) min((uint32_t) SIM800_LOG_BLOCK, _end - _pos);
+  if (!_log.read(_pos, _block, n)) return false;
+  _pos += n;
+  _block_pos = 0;
+  _block_len = n;
+  return true;
+}
+
+int UbirchSIM800LogStream::available() {
+  return (int) min(_end - _pos + (_block_len - _block_pos), (uint32_t) 0x7fff);
+}
+
+int UbirchSIM800LogStream::read() {
+  return fill() ? _block[_block_pos++] : -1;
+}
+
+int UbirchSIM800LogStream::peek() {
+  return fill() ? _block[_block_pos] : -1;
+}
+
+void UbirchSIM800LogStream::flush() { }
+
+size_t UbirchSIM800LogStream::write(uint8_t) {
+  return 0;
+}
+
+UbirchSIM800Log::UbirchSIM800Log(UbirchSIM800Storage &storage) : _storage(storage) { }
+
+bool UbirchSIM800Log::begin() {
+  uint32_t size = _storage.size();
+  if (size <= 2 * SIM800_LOG_CURSOR + SIM800_LOG_HEADER + SIM800_LOG_TRAILER) return false;
+  _ring = size - 2 * SIM800_LOG_CURSOR;
+
+  // the valid cursor slot with the newer generation wins, a torn write leaves the other one intact
+  _head = _head_seq = _cursor_gen = 0;
+  bool found = false;
+  for (uint8_t slot = 0; slot < 2; slot++) {
+    uint8_t cursor[SIM800_LOG_CURSOR];
+    if (!_storage.read(slot * SIM800_LOG_CURSOR, cursor, SIM800_LOG_CURSOR)) return false;
+    if (get16(cursor) != SIM800_LOG_CURSOR_MAGIC) continue;
+    if (get16(cursor + 14) != crc16(0xffff, cursor, 14)) continue;
+
+    uint32_t gen = get32(cursor + 2);
+    if (found && gen <= _cursor_gen) continue;
+    _cursor_gen = gen;
+    _head = get32(cursor + 6) % _ring;
+    _head_seq = get32(cursor + 10);
+    found = true;
+  }
+
+  // walk the records until one is missing, torn or left over from an earlier round
+  _tail = _head;
+  _next_seq = _head_seq;
+  _records = 0;
+  for (;;) {
+    uint32_t frame = check(_tail, _next_seq);
+    if (!frame || _tail - _head + frame > _ring) break;
+    _tail += frame;
+    _next_seq++;
+    _records++;
+  }
+
+  return true;
+}
+
+bool UbirchSIM800Log::append(const char *payload, size_t size) {
+  uint32_t frame = SIM800_LOG_HEADER + size + SIM800_LOG_TRAILER;
+  if (!_ring || size > 0xffff || _tail - _head + frame > _ring) return false;
+
+  uint8_t header[SIM800_LOG_HEADER];
+  header[0] = SIM800_LOG_MAGIC;
+  put16(header + 1, (uint16_t) size);
+  put32(header + 3, _next_seq);
+
+  uint8_t trailer[SIM800_LOG_TRAILER];
+  put16(trailer, crc16(crc16(0xffff, header + 1, SIM800_LOG_HEADER - 1), (const uint8_t *) payload, size));
+
+  // a record torn by a power loss fails the crc and is the end of the log after begin()
+  if (!write(_tail, header, SIM800_LOG_HEADER)) return false;
+  if (!write(_tail + SIM800_LOG_HEADER, (const uint8_t *) payload, size)) return false;
+  if (!write(_tail + SIM800_LOG_HEADER + size, trailer, SIM800_LOG_TRAILER)) return false;
+
+  _tail += frame;
+  _next_seq++;
+  _records++;
+  return true;
+}
+
+uint32_t UbirchSIM800Log::records() {
+  return _records;
+}
+
+uint32_t UbirchSIM800Log::bytes() {
+  return _tail - _head;
+}
+
+uint32_t UbirchSIM800Log::flush(UbirchSIM800 &sim800, const char *url, uint32_t max) {
+  uint32_t forwarded = 0;
+  while (_records) {
+    // take whole records up to max bytes, at least one
+    uint32_t end = _head, seq = _head_seq, count = 0;
+    while (end != _tail) {
+      uint8_t header[3];
+      if (!read(end, header, 3)) return forwarded;
+      uint32_t frame = SIM800_LOG_HEADER + get16(header + 1) + SIM800_LOG_TRAILER;
+      if (count && end - _head + frame > max) break;
+      end += frame;
+      seq++;
+      count++;
+    }
+
+    // the records are streamed from the storage, they are never loaded as a whole
+    UbirchSIM800LogStream body(*this, _head, end);
+    unsigned long int length;
+    unsigned short int status = sim800.HTTP_post(url, length, body, end - _head);
+    if (status < 200 || status >= 300) break;
+
+    // if the power fails before this the records are sent again, never lost
+    if (!commit(end, seq)) break;
+    _records -= count;
+    forwarded += count;
+  }
+  return forwarded;
+}
+
+bool UbirchSIM800Log::read(uint32_t pos, uint8_t *buffer, size_t length) {
+  uint32_t offset = pos % _ring;
+  size_t first = (size_t) min((uint32_t) length, _ring - offset);
+  if (!_storage.read(2 * SIM800_LOG_CURSOR + offset, buffer, first)) return false;
+  return first == length || _storage.read(2 * SIM800_LOG_CURSOR, buffer + first, length - first);
+}
+
+bool UbirchSIM800Log::write(uint32_t pos, const uint8_t *buffer, size_t length) {
+  uint32_t offset = pos % _ring;
+  size_t first = (size_t) min((uint32_t) length, _ring - offset);
+  if (!_storage.write(2 * SIM800_LOG_CURSOR + offset, buffer, first)) return false;
+  return first == length || _storage.write(2 * SIM800_LOG_CURSOR, buffer + first, length - first);
+}
+
+uint32_t UbirchSIM800Log::check(uint32_t pos, uint32_t seq) {
+  uint8_t header[SIM800_LOG_HEADER];
+  if (!read(pos, header, SIM800_LOG_HEADER)) return 0;
+  if (header[0] != SIM800_LOG_MAGIC || get32(header + 3) != seq) return 0;
+
+  uint16_t size = get16(header + 1);
+  uint32_t frame = SIM800_LOG_HEADER + size + SIM800_LOG_TRAILER;
+  if (frame > _ring) return 0;
+
+  uint16_t crc = crc16(0xffff, header + 1, SIM800_LOG_HEADER - 1);
+  uint8_t block[16];
+  for (uint16_t done = 0; done < size;) {
+    uint16_t n = (uint16_t) min((uint16_t) sizeof(block), (uint16_t) (size - done));
+    if (!read(pos + SIM800_LOG_HEADER + done, block, n)) return 0;
+    crc = crc16(crc, block, n);
+    done += n;
+  }
+
+  uint8_t trailer[SIM800_LOG_TRAILER];
+  if (!read(pos + SIM800_LOG_HEADER + size, trailer, SIM800_LOG_TRAILER)) return 0;
+  return get16(trailer) == crc ? frame : 0;
+}
+
+bool UbirchSIM800Log::commit(uint32_t head, uint32_t seq) {
+  // keep the positions small so they never overflow
+  uint32_t wrap = head - head % _ring;
+
+  uint8_t cursor[SIM800_LOG_CURSOR];
+  put16(cursor, SIM800_LOG_CURSOR_MAGIC);
+  put32(cursor + 2, _cursor_gen + 1);
+  put32(cursor + 6, head - wrap);
+  put32(cursor + 10, seq);
+  put16(cursor + 14, crc16(0xffff, cursor, 14));
+  if (!_storage.write(((_cursor_gen + 1) & 1) * SIM800_LOG_CURSOR, cursor, SIM800_LOG_CURSOR)) return false;
+
+  _cursor_gen++;
+  _head = head - wrap;
+  _tail -= wrap;
+  _head_seq = seq;
+  return true;
+}
@@ -0,0 +1,140 @@
+/**
+ * UbirchSIM800Log is a crash-safe store-and-forward queue that keeps
+ * records in a storage region while the network is not available and
+ * forwards them in bulk when it comes back.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UBIRCH_SIM800_LOG_H
+#define UBIRCH_SIM800_LOG_H
+
+#include "UbirchSIM800.h"
+
+// the settings may be overridden with build flags, SIM800_LOG_BLOCK changes the size of
+// UbirchSIM800Log and must be the same for all sources (-DSIM800_LOG_BLOCK=64)
+#ifdef __AVR__
+#ifndef SIM800_LOG_BLOCK
+#define SIM800_LOG_BLOCK 32
+#endif
+#ifndef SIM800_LOG_POST_MAX
+#define SIM800_LOG_POST_MAX 16384UL
+#endif
+#else
+#ifndef SIM800_LOG_BLOCK
+#define SIM800_LOG_BLOCK 256
+#endif
+#ifndef SIM800_LOG_POST_MAX
+#define SIM800_LOG_POST_MAX 65536UL
+#endif
+#endif
+
+// the region starts with two cursor slots that are written alternately
+#define SIM800_LOG_CURSOR 16
+#define SIM800_LOG_CURSOR_MAGIC 0x5C0D
+// records: magic (1), size (2), sequence number (4), payload, crc16 of size, sequence and payload (2)
+#define SIM800_LOG_MAGIC 0xA5
+#define SIM800_LOG_HEADER 7
+#define SIM800_LOG_TRAILER 2
+
+// a byte addressable storage region (EEPROM, FRAM, a file, or flash with a write cache)
+class UbirchSIM800Storage {
+public:
+    // size of the region in bytes
+    virtual uint32_t size() = 0;
+
+    virtual bool read(uint32_t address, uint8_t *buffer, size_t length) = 0;
+
+    // must not return before the data is persistent
+    virtual bool write(uint32_t address, const uint8_t *buffer, size_t length) = 0;
+};
+
+class UbirchSIM800Log;
+
+// reads the raw records between two positions of the log, used as the body of a POST
+class UbirchSIM800LogStream : public Stream {
+public:
+    UbirchSIM800LogStream(UbirchSIM800Log &log, uint32_t start, uint32_t end);
+
+    virtual int available();
+
+    virtual int read();
+
+    virtual int peek();
+
+    virtual void flush();
+
+    virtual size_t write(uint8_t c);
+
+    using Print::write;
+
+private:
+    UbirchSIM800Log &_log;
+    uint32_t _pos;
+    uint32_t _end;
+    uint8_t _block[SIM800_LOG_BLOCK];
+    uint16_t _block_pos = 0;
+    uint16_t _block_len = 0;
+
+    bool fill();
+};
+
+class UbirchSIM800Log {
+    friend class UbirchSIM800LogStream;
+
+public:
+    UbirchSIM800Log(UbirchSIM800Storage &storage);
+
+    // load the read cursor and find the end of the log, call once after power on
+    bool begin();
+
+    // append a record, returns false if the log is full
+    bool append(const char *payload, size_t size);
+
+    // number and size of the records waiting to be forwarded (including framing)
+    uint32_t records();
+    uint32_t bytes();
+
+    // POST the waiting records to the URL, up to max bytes per request, the body is the
+    // framed records as stored, so the server can check the crc and skip sequence numbers
+    // it already has (a request may be repeated if the power fails before the cursor is saved)
+    // returns the number of records the server accepted
+    uint32_t flush(UbirchSIM800 &sim800, const char *url, uint32_t max = SIM800_LOG_POST_MAX);
+
+protected:
+    UbirchSIM800Storage &_storage;
+    uint32_t _ring = 0;      // size of the record area
+    uint32_t _head = 0;      // position of the first record to forward
+    uint32_t _tail = 0;      // position where the next record is appended
+    uint32_t _head_seq = 0;  // sequence number of the first record
+    uint32_t _next_seq = 0;  // sequence number of the next record
+    uint32_t _cursor_gen = 0;
+    uint32_t _records = 0;
+
+    // read and write the record area at a log position, wraps around the end
+    bool read(uint32_t pos, uint8_t *buffer, size_t length);
+    bool write(uint32_t pos, const uint8_t *buffer, size_t length);
+
+    // check the record at pos, returns its size including the framing or 0 if it is not valid
+    uint32_t check(uint32_t pos, uint32_t seq);
+
+    // persist the read cursor in the older of the two slots
+    bool commit(uint32_t head, uint32_t seq);
+};
+
+#endif //UBIRCH_SIM800_LOG_H
@@ -0,0 +1,101 @@
+/**
+ * UbirchSIM800Replay plays back a trace recorded with UbirchSIM800Trace
+ * as a serial port, to reproduce a field session on the host.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "UbirchSIM800Replay.h"
+
+UbirchSIM800Replay::UbirchSIM800Replay(const uint8_t *trace, size_t size) : _trace(trace), _size(size) {
+  size_t start = sizeof(SIM800_TRACE_MAGIC) - 1;
+  if (size < start || memcmp(trace, SIM800_TRACE_MAGIC, start)) start = size;
+  // position both cursors at their first record
+  _rx.record = _rx.data = _tx.record = _tx.data = start;
+  _rx.left = _tx.left = 0;
+  next(_rx, SIM800_TRACE_RX);
+  next(_tx, SIM800_TRACE_TX);
+}
+
+void UbirchSIM800Replay::next(cursor &c, uint8_t type) {
+  while (!c.left && c.data < _size) {
+    // c.data is the end of the current record, or the first record
+    size_t record = c.data;
+    if (record + SIM800_TRACE_HEADER > _size) {
+      c.record = c.data = _size;
+      return;
+    }
+    c.record = record;
+    c.data = record + SIM800_TRACE_HEADER;
+    c.left = _trace[record] == type ? _trace[record + 3] : 0;
+    if (!c.left) c.data += _trace[record + 3];
+  }
+  if (!c.left) c.record = _size;
+}
+
+void UbirchSIM800Replay::begin(uint32_t) { }
+
+int UbirchSIM800Replay::available() {
+  next(_rx, SIM800_TRACE_RX);
+  next(_tx, SIM800_TRACE_TX);
+  // only data that was received before the next pending transmission
+  return _rx.left && _rx.record < _tx.record ? _rx.left : 0;
+}
+
+int UbirchSIM800Replay::read() {
+  if (!available()) return -1;
+  _rx.left--;
+  return _trace[_rx.data++];
+}
+
+int UbirchSIM800Replay::peek() {
+  return available() ? _trace[_rx.data] : -1;
+}
+
+void UbirchSIM800Replay::flush() { }
+
+size_t UbirchSIM800Replay::write(uint8_t c) {
+  next(_tx, SIM800_TRACE_TX);
+  if (!_tx.left) {
+    // sent more than recorded
+    if (!_diverged) _divergence = _size;
+    _diverged = true;
+    return 1;
+  }
+  if (_trace[_tx.data] != c && !_diverged) {
+    _diverged = true;
+    _divergence = _tx.data;
+  }
+  _tx.data++;
+  _tx.left--;
+  return 1;
+}
+
+bool UbirchSIM800Replay::diverged() {
+  return _diverged;
+}
+
+size_t UbirchSIM800Replay::divergence() {
+  return _divergence;
+}
+
+bool UbirchSIM800Replay::done() {
+  next(_rx, SIM800_TRACE_RX);
+  return !_rx.left;
+}
@@ -0,0 +1,76 @@
+/**
+ * UbirchSIM800Replay plays back a trace recorded with UbirchSIM800Trace
+ * as a serial port, to reproduce a field session on the host.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UBIRCH_SIM800_REPLAY_H
+#define UBIRCH_SIM800_REPLAY_H
+
+#include <stdint.h>
+#include <Stream.h>
+#include "UbirchSIM800Trace.h"
+
+// serves the received data of a trace, data recorded after something was sent only becomes
+// available once the driver has sent as much again, so the session plays back in the same order
+// independent of timing, select it with -DSIM800_SERIAL_TYPE=UbirchSIM800Replay
+class UbirchSIM800Replay : public Stream {
+public:
+    UbirchSIM800Replay(const uint8_t *trace, size_t size);
+
+    void begin(uint32_t rate);
+
+    virtual int available();
+
+    virtual int read();
+
+    virtual int peek();
+
+    virtual void flush();
+
+    virtual size_t write(uint8_t c);
+
+    using Print::write;
+
+    // true if the driver sent something else than recorded, offset is where in the trace it happened
+    bool diverged();
+    size_t divergence();
+
+    // true when all received data was played back
+    bool done();
+
+private:
+    struct cursor {
+        size_t record; // offset of the current record
+        size_t data;   // offset of the next byte
+        uint8_t left;  // bytes left in the record
+    };
+
+    const uint8_t *_trace;
+    size_t _size;
+    cursor _rx;
+    cursor _tx;
+    bool _diverged = false;
+    size_t _divergence = 0;
+
+    // move the cursor to the next record of the type if the current one is used up
+    void next(cursor &c, uint8_t type);
+};
+
+#endif //UBIRCH_SIM800_REPLAY_H
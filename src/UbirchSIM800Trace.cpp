@@ -0,0 +1,123 @@
+/**
+ * UbirchSIM800Trace records the serial traffic with the SIM800 into a
+ * ring buffer of timestamped binary records that can be dumped on demand
+ * and replayed on the host (see UbirchSIM800Replay, tools/sim800_trace.py).
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Arduino.h>
+#include "UbirchSIM800.h"
+
+#ifdef SIM800_TRACE
+
+UbirchSIM800Trace::UbirchSIM800Trace(const SIM800_SERIAL_TYPE &port) : _port(port) { }
+
+void UbirchSIM800Trace::begin(uint32_t rate) {
+  _port.begin(rate);
+  make_room(SIM800_TRACE_HEADER + 4);
+  begin_record(SIM800_TRACE_BAUD, millis());
+  for (uint8_t i = 0; i < 4; i++) at(_used++) = (uint8_t) (rate >> (8 * i));
+  at(_record + 3) = 4;
+  _open = false;
+}
+
+int UbirchSIM800Trace::available() {
+  return _port.available();
+}
+
+int UbirchSIM800Trace::read() {
+  int c = _port.read();
+  if (c != -1) put(SIM800_TRACE_RX, (uint8_t) c);
+  return c;
+}
+
+int UbirchSIM800Trace::peek() {
+  return _port.peek();
+}
+
+void UbirchSIM800Trace::flush() {
+  _port.flush();
+}
+
+size_t UbirchSIM800Trace::write(uint8_t c) {
+  put(SIM800_TRACE_TX, c);
+  return _port.write(c);
+}
+
+size_t UbirchSIM800Trace::write(const uint8_t *buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) put(SIM800_TRACE_TX, buffer[i]);
+  return _port.write(buffer, size);
+}
+
+void UbirchSIM800Trace::dump(Print &out) {
+  out.print(F(SIM800_TRACE_MAGIC));
+  for (uint16_t i = 0; i < _used; i++) out.write(at(i));
+}
+
+void UbirchSIM800Trace::clear() {
+  _head = _used = 0;
+  _open = false;
+}
+
+uint8_t &UbirchSIM800Trace::at(uint16_t offset) {
+  uint16_t i = _head + offset;
+  return _ring[i >= SIM800_TRACE ? i - SIM800_TRACE : i];
+}
+
+void UbirchSIM800Trace::put(uint8_t type, uint8_t c) {
+  unsigned long now = millis();
+  bool append = _open && type == _type && now == _time && at(_record + 3) < 255;
+  if (append && _used == SIM800_TRACE) {
+    make_room(1);
+    append = _open;
+  }
+  if (!append) begin_record(type, now);
+
+  at(_used++) = c;
+  at(_record + 3)++;
+}
+
+void UbirchSIM800Trace::begin_record(uint8_t type, unsigned long now) {
+  make_room(SIM800_TRACE_HEADER + 1);
+
+  unsigned long delta = now - _time;
+  if (delta > 0xffff) delta = 0xffff;
+  _record = _used;
+  at(_used++) = type;
+  at(_used++) = (uint8_t) delta;
+  at(_used++) = (uint8_t) (delta >> 8);
+  at(_used++) = 0;
+  _open = true;
+  _type = type;
+  _time = now;
+}
+
+void UbirchSIM800Trace::make_room(uint16_t n) {
+  while (SIM800_TRACE - _used < n) {
+    uint16_t size = SIM800_TRACE_HEADER + at(3);
+    if (_open) {
+      if (_record < size) _open = false;
+      else _record -= size;
+    }
+    _head = (uint16_t) ((_head + size) % SIM800_TRACE);
+    _used -= size;
+  }
+}
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * UbirchSIM800Trace records the serial traffic with the SIM800 into a
+ * ring buffer of timestamped binary records that can be dumped on demand
+ * and replayed on the host (see UbirchSIM800Replay, tools/sim800_trace.py).
+ *
+ * Enable it with -DSIM800_TRACE=<ring size in bytes>, it replaces the
+ * serial port of UbirchSIM800 and passes everything through.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UBIRCH_SIM800_TRACE_H
+#define UBIRCH_SIM800_TRACE_H
+
+// dump format: the magic, then records of type (1), ms since the previous record (2, little endian,
+// saturated), length (1) and the data, consecutive bytes in the same direction and ms share a record
+#define SIM800_TRACE_MAGIC "SIM800TR"
+#define SIM800_TRACE_TX   'T'
+#define SIM800_TRACE_RX   'R'
+#define SIM800_TRACE_BAUD 'B' // the serial port was (re)started, data is the baud rate (4 bytes)
+#define SIM800_TRACE_HEADER 4
+
+#endif //UBIRCH_SIM800_TRACE_H
+
+// the recorder wraps the serial port type selected in UbirchSIM800.h, which includes this file again
+// (UbirchSIM800Replay.h only needs the format and may be built without the port type declared)
+#if defined(SIM800_TRACE) && defined(UBIRCH_SIM800_H) && defined(SIM800_SERIAL_TYPE) && !defined(UBIRCH_SIM800_TRACE_RECORDER)
+#define UBIRCH_SIM800_TRACE_RECORDER
+
+class UbirchSIM800Trace : public Stream {
+public:
+    UbirchSIM800Trace(const SIM800_SERIAL_TYPE &port);
+
+    void begin(uint32_t rate);
+
+    virtual int available();
+
+    virtual int read();
+
+    virtual int peek();
+
+    virtual void flush();
+
+    virtual size_t write(uint8_t c);
+
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    using Print::write;
+
+    // write the recorded records, oldest first
+    void dump(Print &out);
+
+    void clear();
+
+private:
+    SIM800_SERIAL_TYPE _port;
+
+    uint8_t _ring[SIM800_TRACE];
+    uint16_t _head = 0; // oldest record
+    uint16_t _used = 0;
+
+    // the record that is appended to while the direction and time stay the same
+    bool _open = false;
+    uint16_t _record = 0;
+    uint8_t _type = 0;
+    unsigned long _time = 0;
+
+    void put(uint8_t type, uint8_t c);
+
+    void begin_record(uint8_t type, unsigned long now);
+
+    // drop the oldest records until n bytes are free
+    void make_room(uint16_t n);
+
+    uint8_t &at(uint16_t offset);
+};
+
+#endif
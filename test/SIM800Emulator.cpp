@@ -0,0 +1,685 @@
+/**
+ * SIM800Emulator simulates a SIM800 chip on the host.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <stdio.h>
+#include "SIM800Emulator.h"
+
+#define MS 1000ULL
+#define SECOND 1000000ULL
+
+static const uint32_t _rates[] = {0, 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800};
+
+// counts the time spent inside the emulator
+struct SIM800EmulatorBusy {
+  int &busy;
+
+  SIM800EmulatorBusy(int &busy) : busy(busy) { busy++; }
+
+  ~SIM800EmulatorBusy() { busy--; }
+};
+
+static bool starts(const std::string &s, const char *prefix) {
+  return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static std::string number(uint32_t n) {
+  char s[12];
+  snprintf(s, sizeof(s), "%u", n);
+  return s;
+}
+
+static void pin_write(uint8_t pin, uint8_t value) {
+  sim800_emulator().pin(pin, value);
+}
+
+static int pin_read(uint8_t pin) {
+  return sim800_emulator().pin(pin);
+}
+
+static void yield_hook() {
+  sim800_emulator().available();
+}
+
+SIM800Emulator &sim800_emulator() {
+  static SIM800Emulator emulator;
+  return emulator;
+}
+
+SIM800Emulator::SIM800Emulator() {
+  host_pin_hooks.write = pin_write;
+  host_pin_hooks.read = pin_read;
+  host_yield_hook = yield_hook;
+  _host_rate = 115200;
+  restart();
+}
+
+void SIM800Emulator::restart(const sim800_emulator_config_t &c) {
+  config = c;
+  commands = tx_bytes = rx_bytes = 0;
+  log.clear();
+  on_command = NULL;
+  http = NULL;
+  http_body.clear();
+  requests.clear();
+  on_data = NULL;
+  for (uint8_t i = 0; i < SIM800_EMULATOR_LINKS; i++) remote[i].clear();
+  clock = "16/04/24,12:34:56+08";
+  _saved_rate = 0;
+  _key_down = _rst_low = false;
+  boot();
+  _ready_at = _registered_at = host_time();
+}
+
+bool SIM800Emulator::busy() {
+  return _busy > 0;
+}
+
+bool SIM800Emulator::powered() {
+  return _powered && now() >= _ready_at;
+}
+
+uint32_t SIM800Emulator::baud() {
+  return _rate;
+}
+
+uint64_t SIM800Emulator::now() {
+  return _in_event ? _event_now : host_time();
+}
+
+uint32_t SIM800Emulator::byte_time(uint32_t rate) {
+  // start bit, 8 data bits, stop bit
+  return (uint32_t) (10 * SECOND / (rate ? rate : 115200));
+}
+
+void SIM800Emulator::at(uint64_t time, std::function<void()> event) {
+  _events.insert(std::make_pair(time, event));
+}
+
+void SIM800Emulator::service() {
+  SIM800EmulatorBusy busy(_busy);
+  uint64_t t = host_time();
+
+  // holding the power key for a second toggles the power
+  if (_key_down && !_key_toggled && t - _key_low >= SECOND) {
+    _key_toggled = true;
+    if (_powered) power_off();
+    else boot();
+  }
+
+  while (!_events.empty() && _events.begin()->first <= t) {
+    std::function<void()> event = _events.begin()->second;
+    _event_now = _events.begin()->first;
+    _events.erase(_events.begin());
+    _in_event = true;
+    event();
+    _in_event = false;
+  }
+
+}
+
+void SIM800Emulator::put(const std::string &data) {
+  uint32_t rate = _rate ? _rate : _host_rate;
+  uint64_t t = std::max(now(), _line_free);
+  for (size_t i = 0; i < data.size(); i++) {
+    t += byte_time(rate);
+    byte_t b = {t, rate, (uint8_t) data[i]};
+    _out.push_back(b);
+  }
+  _line_free = t;
+}
+
+void SIM800Emulator::emit(const std::string &data, uint32_t after) {
+  at(now() + after * MS, [this, data]() { put(data); });
+}
+
+void SIM800Emulator::reply(const std::string &line, uint32_t after) {
+  emit("\r\n" + line + "\r\n", config.latency + after);
+}
+
+void SIM800Emulator::reply_ok(const std::string &line, uint32_t after) {
+  emit("\r\n" + line + "\r\n\r\nOK\r\n", config.latency + after);
+}
+
+void SIM800Emulator::urc(const std::string &line, uint32_t after) {
+  SIM800EmulatorBusy busy(_busy);
+  emit("\r\n" + line + "\r\n", after);
+}
+
+void SIM800Emulator::boot() {
+  _events.clear();
+  _out.clear();
+  _line_free = now();
+  _powered = true;
+  _ready_at = now() + config.boot * MS;
+  _registered_at = now() + config.registration * MS;
+  _rate = _saved_rate;
+  _echo = true;
+  _mode = COMMAND;
+  _command.clear();
+  _plus = 0;
+
+  _creg_mode = 0;
+  _attached = true;
+  _bearer = false;
+  _ip = _mux = _cipmode = _rxget = _qsend = 0;
+  _links = 0;
+  for (uint8_t i = 0; i < SIM800_EMULATOR_LINKS; i++) {
+    _link_rx[i].clear();
+    _link_sent[i] = 0;
+  }
+  _uplink_free = _downlink_free = 0;
+  _http = false;
+  _http_para.clear();
+
+  // the chip only greets with a fixed baud rate, it does not know the rate otherwise
+  if (_rate) {
+    at(_ready_at, [this]() { put("\r\nRDY\r\n\r\n+CPIN: READY\r\n\r\nCall Ready\r\n\r\nSMS Ready\r\n"); });
+  }
+  at(_registered_at, [this]() {
+    if (_creg_mode == 1) urc("+CREG: 1");
+    if (_creg_mode == 2) urc("+CREG: 1,\"1A2B\",\"3C4D\"");
+  });
+}
+
+void SIM800Emulator::power_off() {
+  _events.clear();
+  _powered = false;
+  _mode = COMMAND;
+}
+
+bool SIM800Emulator::registered() {
+  return _powered && now() >= _registered_at;
+}
+
+uint64_t SIM800Emulator::link_time(uint64_t &free, size_t bytes) {
+  uint64_t start = std::max(now(), free);
+  free = start + bytes * SECOND / config.link_rate;
+  return free;
+}
+
+void SIM800Emulator::push(uint8_t link, const std::string &data, uint32_t after) {
+  SIM800EmulatorBusy busy(_busy);
+  uint64_t arrival = link_time(_downlink_free, data.size()) + (config.network + after) * MS;
+  at(arrival, [this, link, data]() {
+    if (!(_links & (1 << link))) return;
+    if (_mode == TRANSPARENT) {
+      put(data);
+    } else if (_rxget) {
+      bool notify = _link_rx[link].empty();
+      _link_rx[link] += data;
+      if (notify) urc(_mux ? "+CIPRXGET: 1," + number(link) : "+CIPRXGET: 1");
+    } else {
+      put("\r\n+RECEIVE," + number(link) + "," + number((uint32_t) data.size()) + ":\r\n" + data);
+    }
+  });
+}
+
+void SIM800Emulator::close(uint8_t link) {
+  SIM800EmulatorBusy busy(_busy);
+  if (!(_links & (1 << link))) return;
+  _links &= ~(1 << link);
+  if (_mode == TRANSPARENT) {
+    _mode = COMMAND;
+    urc("CLOSED");
+  } else {
+    urc(_mux ? number(link) + ", CLOSED" : "CLOSED");
+  }
+}
+
+void SIM800Emulator::drop_pdp() {
+  SIM800EmulatorBusy busy(_busy);
+  _bearer = false;
+  _ip = 0;
+  _links = 0;
+  _mode = COMMAND;
+  urc("+PDP: DEACT");
+}
+
+void SIM800Emulator::drop_bearer() {
+  SIM800EmulatorBusy busy(_busy);
+  _bearer = false;
+  urc("+SAPBR 1: DEACT");
+}
+
+void SIM800Emulator::begin(uint32_t rate) {
+  SIM800EmulatorBusy busy(_busy);
+  service();
+  _host_rate = rate;
+}
+
+int SIM800Emulator::available() {
+  SIM800EmulatorBusy busy(_busy);
+  service();
+  uint64_t t = host_time();
+  std::deque<byte_t>::iterator end = std::upper_bound(
+      _out.begin(), _out.end(), t, [](uint64_t time, const byte_t &b) { return time < b.at; });
+  return (int) (end - _out.begin());
+}
+
+int SIM800Emulator::read() {
+  SIM800EmulatorBusy busy(_busy);
+  int c = peek();
+  if (c != -1) {
+    _out.pop_front();
+    rx_bytes++;
+  }
+  return c;
+}
+
+int SIM800Emulator::peek() {
+  SIM800EmulatorBusy busy(_busy);
+  service();
+  if (_out.empty() || _out.front().at > host_time()) return -1;
+  // sent with another rate than the host uses, it is garbage
+  return _out.front().rate == _host_rate ? _out.front().c : 0xff;
+}
+
+size_t SIM800Emulator::write(const uint8_t *buffer, size_t size) {
+  SIM800EmulatorBusy busy(_busy);
+  std::string transparent;
+  for (size_t i = 0; i < size; i++) {
+    // the host waits until the UART took the byte
+    host_advance(byte_time(_host_rate));
+    service();
+    tx_bytes++;
+
+    // the chip does not listen while it boots and does not understand another rate
+    if (!powered() || (_rate && _rate != _host_rate)) continue;
+    uint8_t c = buffer[i];
+
+    if (_mode == TRANSPARENT) {
+      // "+++" with a second of silence before and after it leaves transparent mode
+      if (c == '+' && (_plus || now() - _last_in >= SECOND) && _plus < 3) {
+        _plus++;
+        _plus_at = now();
+        // the escape sequence needs a second of silence after it
+        if (_plus == 3) {
+          uint64_t escaped = _plus_at;
+          at(escaped + SECOND, [this, escaped]() {
+            if (_mode != TRANSPARENT || _plus != 3 || _plus_at != escaped) return;
+            _mode = COMMAND;
+            _plus = 0;
+            put("\r\nOK\r\n");
+          });
+        }
+      } else {
+        transparent.append(_plus, '+');
+        transparent += (char) c;
+        _plus = 0;
+      }
+      _last_in = now();
+      continue;
+    }
+    receive(c);
+  }
+
+  if (!transparent.empty()) {
+    remote[0] += transparent;
+    if (on_data) on_data(0, transparent);
+  }
+  service();
+  return size;
+}
+
+void SIM800Emulator::receive(uint8_t c) {
+  // a line feed after the carriage return that ended a command is not data
+  bool skip = _skip_lf && c == '\n';
+  _skip_lf = false;
+  if (skip) return;
+
+  if (_mode == SEND_DATA || _mode == HTTP_DATA) {
+    _data += (char) c;
+    if (!--_data_left) data_done();
+    return;
+  }
+
+  if (_echo) put(std::string(1, (char) c));
+  if (c == '\r') {
+    std::string line = _command;
+    _command.clear();
+    _skip_lf = true;
+    if (!line.empty()) command(line);
+  } else if (c != '\n' && _command.size() < 1024) {
+    _command += (char) c;
+  }
+}
+
+void SIM800Emulator::data_done() {
+  std::string data = _data;
+  _data.clear();
+  if (_mode == HTTP_DATA) {
+    _mode = COMMAND;
+    _http_data = data;
+    reply("OK");
+    return;
+  }
+
+  _mode = COMMAND;
+  uint8_t link = _data_link;
+  _link_sent[link] += (uint32_t) data.size();
+  // the chip accepts the data when it went out over the cell link, the peer sees it a bit later
+  uint64_t sent = link_time(_uplink_free, data.size());
+  std::string accepted = _qsend ? "DATA ACCEPT:" : "";
+  if (_qsend) accepted += (_mux ? number(link) + "," : "") + number((uint32_t) data.size());
+  else accepted = _mux ? number(link) + ", SEND OK" : "SEND OK";
+  at(sent, [this, accepted]() { put("\r\n" + accepted + "\r\n"); });
+  at(sent + config.network * MS, [this, link, data]() {
+    remote[link] += data;
+    if (on_data) on_data(link, data);
+  });
+}
+
+void SIM800Emulator::command(const std::string &line) {
+  log.push_back(line);
+  commands++;
+
+  std::string answer;
+  if (on_command && on_command(line, answer)) {
+    if (!answer.empty()) emit(answer, config.latency);
+    return;
+  }
+  if (line.size() < 2 || toupper(line[0]) != 'A' || toupper(line[1]) != 'T') return;
+  std::string cmd = line.substr(2);
+  unsigned int a = 0, b = 0;
+
+  if (cmd.empty() || cmd == "+IFC=0,0" || starts(cmd, "+CIURC=") || starts(cmd, "+CMEE=") ||
+      starts(cmd, "+CPIN=") || starts(cmd, "+SAPBR=3,1,")) {
+    reply("OK");
+  } else if (cmd == "E0" || cmd == "E1") {
+    _echo = cmd == "E1";
+    reply("OK");
+  } else if (cmd == "+IPR?") {
+    reply_ok("+IPR: " + number(_rate));
+  } else if (sscanf(cmd.c_str(), "+IPR=%u", &a) == 1) {
+    if (a > config.max_baud || std::find(_rates, _rates + sizeof(_rates) / sizeof(_rates[0]), a) ==
+                               _rates + sizeof(_rates) / sizeof(_rates[0])) {
+      reply("ERROR");
+      return;
+    }
+    // the answer still goes out with the old rate
+    reply("OK");
+    at(now() + config.latency * MS + 1, [this, a]() { _rate = a; });
+  } else if (cmd == "&W") {
+    _saved_rate = _rate;
+    reply("OK");
+  } else if (cmd == "+CREG?") {
+    std::string creg = "+CREG: " + number(_creg_mode) + "," + (registered() ? "1" : "2");
+    if (_creg_mode == 2 && registered()) creg += ",\"1A2B\",\"3C4D\"";
+    reply_ok(creg);
+  } else if (sscanf(cmd.c_str(), "+CREG=%u", &a) == 1) {
+    _creg_mode = (uint8_t) a;
+    reply("OK");
+  } else if (cmd == "+CGATT?") {
+    reply_ok(_attached && registered() ? "+CGATT: 1" : "+CGATT: 0");
+  } else if (cmd == "+CGATT=1") {
+    _attached = true;
+    reply(registered() ? "OK" : "ERROR", config.network);
+  } else if (cmd == "+CGATT=0") {
+    _attached = _bearer = false;
+    reply("OK", config.network);
+  } else if (cmd == "+SAPBR=1,1") {
+    bool ok = !_bearer && _attached && registered();
+    if (ok) _bearer = true;
+    reply(ok ? "OK" : "ERROR", 2 * config.network);
+  } else if (cmd == "+SAPBR=2,1") {
+    reply_ok(_bearer ? "+SAPBR: 1,1,\"10.0.0.2\"" : "+SAPBR: 1,3,\"0.0.0.0\"");
+  } else if (cmd == "+SAPBR=0,1") {
+    bool ok = _bearer;
+    _bearer = false;
+    reply(ok ? "OK" : "ERROR", config.network);
+  } else if (cmd == "+CIPSHUT") {
+    _links = 0;
+    _ip = 0;
+    reply("SHUT OK", config.network);
+  } else if (cmd == "+CIPMUX?") {
+    reply_ok("+CIPMUX: " + number(_mux));
+  } else if (sscanf(cmd.c_str(), "+CIPMUX=%u", &a) == 1) {
+    if (!_ip) _mux = (uint8_t) a;
+    reply(_ip ? "ERROR" : "OK");
+  } else if (sscanf(cmd.c_str(), "+CIPMODE=%u", &a) == 1) {
+    if (!_ip) _cipmode = (uint8_t) a;
+    reply(_ip ? "ERROR" : "OK");
+  } else if (sscanf(cmd.c_str(), "+CIPQSEND=%u", &a) == 1) {
+    _qsend = (uint8_t) a;
+    reply("OK");
+  } else if (starts(cmd, "+CSTT=")) {
+    if (!_ip) _ip = 1;
+    reply(_ip == 1 ? "OK" : "ERROR");
+  } else if (cmd == "+CIICR") {
+    bool ok = _ip == 1 && _attached && registered();
+    if (ok) _ip = 2;
+    reply(ok ? "OK" : "ERROR", 2 * config.network);
+  } else if (cmd == "+CIFSR") {
+    if (_ip >= 2) _ip = 3;
+    reply(_ip == 3 ? "10.0.0.2" : "ERROR");
+  } else if (cmd == "+CIPSTATUS") {
+    static const char *const states[] = {"IP INITIAL", "IP START", "IP GPRSACT", "IP STATUS"};
+    std::string status = "\r\nOK\r\n\r\nSTATE: ";
+    if (!_mux && _links) status += "CONNECT OK";
+    else status += _ip == 3 && _links ? "IP PROCESSING" : states[_ip];
+    status += "\r\n";
+    for (uint8_t i = 0; _mux && i < SIM800_EMULATOR_LINKS; i++) {
+      if (_links & (1 << i)) status += "\r\nC: " + number(i) + ",0,\"TCP\",\"" + _link_host[i] + "\",\"CONNECTED\"\r\n";
+      else status += "\r\nC: " + number(i) + ",,\"\",\"\",\"\",\"INITIAL\"\r\n";
+    }
+    emit(status, config.latency);
+  } else if (sscanf(cmd.c_str(), "+CIPSTATUS=%u", &a) == 1 && a < SIM800_EMULATOR_LINKS) {
+    if (_links & (1 << a)) reply_ok("+CIPSTATUS: " + number(a) + ",0,\"TCP\",\"" + _link_host[a] + "\",\"CONNECTED\"");
+    else reply_ok("+CIPSTATUS: " + number(a) + ",,\"\",\"\",\"\",\"INITIAL\"");
+  } else if (starts(cmd, "+CIPSTART=")) {
+    uint8_t link = 0;
+    std::string args = cmd.substr(10);
+    if (_mux) {
+      if (sscanf(args.c_str(), "%u,", &a) != 1 || a >= SIM800_EMULATOR_LINKS) {
+        reply("ERROR");
+        return;
+      }
+      link = (uint8_t) a;
+      args = args.substr(args.find(',') + 1);
+    }
+    if (_ip != 3 || !registered()) {
+      reply("ERROR");
+      return;
+    }
+    if (_links & (1 << link)) {
+      reply(_mux ? number(link) + ", ALREADY CONNECT" : "ALREADY CONNECT");
+      return;
+    }
+    // "TCP","<host>","<port>" is kept as "<host>","<port>"
+    _link_host[link] = args.size() > 7 ? args.substr(7, args.size() - 8) : args;
+    reply("OK");
+    at(now() + (config.latency + 2 * config.network) * MS, [this, link]() {
+      _links |= 1 << link;
+      _link_rx[link].clear();
+      _link_sent[link] = 0;
+      remote[link].clear();
+      if (_mux) {
+        put("\r\n" + number(link) + ", CONNECT OK\r\n");
+      } else if (_cipmode) {
+        put("\r\nCONNECT\r\n");
+        _mode = TRANSPARENT;
+        _last_in = now();
+      } else {
+        put("\r\nCONNECT OK\r\n");
+      }
+    });
+  } else if (starts(cmd, "+CIPSEND=")) {
+    uint8_t link = 0;
+    size_t n;
+    if (_mux) n = sscanf(cmd.c_str(), "+CIPSEND=%u,%u", &a, &b) == 2 ? b : 0;
+    else n = sscanf(cmd.c_str(), "+CIPSEND=%u", &b) == 1 ? b : 0;
+    if (_mux) link = (uint8_t) a;
+    if (!n || n > 1460 || link >= SIM800_EMULATOR_LINKS || !(_links & (1 << link))) {
+      reply("ERROR");
+      return;
+    }
+    emit("> ", config.latency);
+    _mode = SEND_DATA;
+    _data_left = n;
+    _data_link = link;
+  } else if (sscanf(cmd.c_str(), "+CIPRXGET=4,%u", &a) == 1 && a < SIM800_EMULATOR_LINKS) {
+    reply_ok("+CIPRXGET: 4," + number(a) + "," + number((uint32_t) _link_rx[a].size()));
+  } else if (sscanf(cmd.c_str(), "+CIPRXGET=2,%u,%u", &a, &b) == 2 && a < SIM800_EMULATOR_LINKS) {
+    size_t n = std::min((size_t) std::min(b, 1460u), _link_rx[a].size());
+    std::string data = _link_rx[a].substr(0, n);
+    _link_rx[a].erase(0, n);
+    emit("\r\n+CIPRXGET: 2," + number(a) + "," + number((uint32_t) n) + "," + number((uint32_t) _link_rx[a].size()) +
+         "\r\n" + data + "\r\nOK\r\n", config.latency);
+  } else if (sscanf(cmd.c_str(), "+CIPRXGET=%u", &a) == 1) {
+    _rxget = (uint8_t) a;
+    reply("OK");
+  } else if (cmd == "+CIPCLOSE" || sscanf(cmd.c_str(), "+CIPCLOSE=%u", &a) == 1) {
+    uint8_t link = cmd == "+CIPCLOSE" ? 0 : (uint8_t) a;
+    bool ok = link < SIM800_EMULATOR_LINKS && (_links & (1 << link));
+    if (ok) _links &= ~(1 << link);
+    if (!ok) reply("ERROR");
+    else reply(_mux ? number(link) + ", CLOSE OK" : "CLOSE OK");
+  } else if (sscanf(cmd.c_str(), "+CIPACK=%u", &a) == 1 && a < SIM800_EMULATOR_LINKS) {
+    reply_ok("+CIPACK: " + number(_link_sent[a]) + "," + number(_link_sent[a]) + ",0");
+  } else if (cmd == "+HTTPINIT") {
+    bool ok = !_http;
+    _http = true;
+    _http_para.clear();
+    reply(ok ? "OK" : "ERROR");
+  } else if (cmd == "+HTTPTERM") {
+    bool ok = _http;
+    _http = false;
+    reply(ok ? "OK" : "ERROR");
+  } else if (starts(cmd, "+HTTPPARA=\"")) {
+    size_t quote = cmd.find('"', 11);
+    if (!_http || quote == std::string::npos || quote + 1 >= cmd.size() || cmd[quote + 1] != ',') {
+      reply("ERROR");
+      return;
+    }
+    std::string value = cmd.substr(quote + 2);
+    if (value.size() >= 2 && value[0] == '"' && value[value.size() - 1] == '"')
+      value = value.substr(1, value.size() - 2);
+    _http_para[cmd.substr(11, quote - 11)] = value;
+    reply("OK");
+  } else if (sscanf(cmd.c_str(), "+HTTPDATA=%u,%u", &a, &b) == 2) {
+    if (!_http || a > 319488) {
+      reply("ERROR");
+      return;
+    }
+    reply("DOWNLOAD");
+    _data.clear();
+    if (a) {
+      _mode = HTTP_DATA;
+      _data_left = a;
+    } else {
+      _http_data.clear();
+      reply("OK");
+    }
+  } else if (sscanf(cmd.c_str(), "+HTTPACTION=%u", &a) == 1) {
+    if (!_http || a > 1) {
+      reply("ERROR");
+      return;
+    }
+    reply("OK");
+    sim800_emulator_request_t request;
+    request.method = (uint8_t) a;
+    request.url = _http_para["URL"];
+    request.userdata = _http_para["USERDATA"];
+    if (a == 1) request.body = _http_data;
+    requests.push_back(request);
+
+    std::string response;
+    uint16_t status = _bearer ? serve(request, response) : 601;
+    if (status >= 600) response.clear();
+    _http_response = response;
+    // the request goes up the cell link and the response comes back down
+    uint64_t done = link_time(_uplink_free, request.body.size() + request.url.size() + 100) + config.network * MS;
+    done = std::max(done, _downlink_free) + config.network * MS + response.size() * SECOND / config.link_rate;
+    _downlink_free = done;
+    at(done, [this, a, status, response]() {
+      put("\r\n+HTTPACTION: " + number(a) + "," + number(status) + "," + number((uint32_t) response.size()) + "\r\n");
+    });
+  } else if (cmd == "+HTTPREAD" || sscanf(cmd.c_str(), "+HTTPREAD=%u,%u", &a, &b) == 2) {
+    if (!_http) {
+      reply("ERROR");
+      return;
+    }
+    if (cmd == "+HTTPREAD") {
+      a = 0;
+      b = (unsigned int) _http_response.size();
+    }
+    std::string data = a < _http_response.size() ? _http_response.substr(a, b) : std::string();
+    emit("\r\n+HTTPREAD: " + number((uint32_t) data.size()) + "\r\n" + data + "\r\nOK\r\n", config.latency);
+  } else if (cmd == "+CCLK?") {
+    reply_ok("+CCLK: \"" + clock + "\"");
+  } else if (cmd == "+CBC") {
+    reply_ok("+CBC: 0,87,4112");
+  } else if (cmd == "+GSN") {
+    reply_ok("869012345678901");
+  } else if (cmd == "+CIPGSMLOC=1,1") {
+    if (_bearer) reply_ok("+CIPGSMLOC: 0,13.404954,52.520008,2016/04/24,12:34:56", 2 * config.network);
+    else reply_ok("+CIPGSMLOC: 601", 2 * config.network);
+  } else if (cmd == "+CPOWD=1") {
+    reply("NORMAL POWER DOWN");
+    at(now() + (config.latency + 100) * MS, [this]() { power_off(); });
+  } else {
+    reply("ERROR");
+  }
+}
+
+uint16_t SIM800Emulator::serve(const sim800_emulator_request_t &request, std::string &response) {
+  if (http) return http(request, response);
+  if (request.method == 1) return 200;
+  if (http_body.empty()) return 404;
+
+  unsigned int first, last;
+  size_t range = request.userdata.find("Range: bytes=");
+  if (range == std::string::npos || sscanf(request.userdata.c_str() + range, "Range: bytes=%u-%u", &first, &last) != 2) {
+    response = http_body;
+    return 200;
+  }
+  if (first >= http_body.size()) return 416;
+  last = std::min(last, (unsigned int) http_body.size() - 1);
+  response = http_body.substr(first, last - first + 1);
+  return 206;
+}
+
+void SIM800Emulator::pin(uint8_t pin, uint8_t value) {
+  SIM800EmulatorBusy busy(_busy);
+  service();
+  if (pin == config.key) {
+    if (value == LOW && !_key_down) {
+      _key_down = true;
+      _key_toggled = false;
+      _key_low = host_time();
+    } else if (value == HIGH) {
+      _key_down = false;
+    }
+  } else if (pin == config.rst) {
+    // the chip restarts when reset is released
+    if (value == LOW) _rst_low = true;
+    else if (_rst_low && _powered) boot();
+    if (value == HIGH) _rst_low = false;
+  }
+}
+
+int SIM800Emulator::pin(uint8_t pin) {
+  SIM800EmulatorBusy busy(_busy);
+  service();
+  if (pin == config.ps) return _powered ? HIGH : LOW;
+  return -1;
+}
@@ -0,0 +1,244 @@
+/**
+ * SIM800Emulator simulates a SIM800 chip on the host: it answers the AT
+ * commands the library uses, runs a small HTTP server and TCP peers and
+ * models the UART baud rate and the latency and bandwidth of the cell
+ * link on the virtual clock of the Arduino shim.
+ *
+ * The library talks to it through SIM800EmulatorSerial, build it with
+ *   -DSIM800_SERIAL_INCLUDE="SIM800Emulator.h"
+ *   -DSIM800_SERIAL_TYPE=SIM800EmulatorSerial
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM800_EMULATOR_H
+#define SIM800_EMULATOR_H
+
+#include <Arduino.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#define SIM800_EMULATOR_LINKS 6
+
+struct sim800_emulator_config_t {
+    uint32_t latency = 2;           // ms until the chip answers a command
+    uint32_t network = 150;         // ms one way over the cell link (a round trip is twice that)
+    uint32_t link_rate = 10000;     // bytes/s the cell link carries in each direction
+    uint32_t boot = 2000;           // ms from power on or reset until the chip answers
+    uint32_t registration = 1500;   // ms from power on until the chip is registered
+    uint32_t max_baud = 460800;     // fastest rate AT+IPR accepts
+    uint8_t rst = 6;                // pins the chip is wired to
+    uint8_t key = 7;
+    uint8_t ps = 8;
+};
+
+// an HTTP request as the chip sends it
+struct sim800_emulator_request_t {
+    uint8_t method; // 0 = GET, 1 = POST
+    std::string url;
+    std::string userdata; // extra header lines (AT+HTTPPARA="USERDATA")
+    std::string body;
+};
+
+class SIM800Emulator {
+public:
+    sim800_emulator_config_t config;
+
+    // commands received (one per AT line) and bytes on the wire in both directions
+    uint32_t commands = 0;
+    uint32_t tx_bytes = 0; // from the host to the chip
+    uint32_t rx_bytes = 0; // from the chip to the host
+
+    // all command lines received, without the line end
+    std::vector<std::string> log;
+
+    // answer a command differently: return true and set the reply (sent as is, may be empty)
+    std::function<bool(const std::string &command, std::string &reply)> on_command;
+
+    // the HTTP server, returns the status and fills the response body, the default serves
+    // http_body (honoring a Range header) for GET and accepts any POST
+    std::function<uint16_t(const sim800_emulator_request_t &request, std::string &response)> http;
+    std::string http_body;
+    std::vector<sim800_emulator_request_t> requests;
+
+    // the remote side of the links, called with what it received
+    std::function<void(uint8_t link, const std::string &data)> on_data;
+    std::string remote[SIM800_EMULATOR_LINKS];
+
+    // what AT+CCLK? reports
+    std::string clock = "16/04/24,12:34:56+08";
+
+    SIM800Emulator();
+
+    // power on with a fresh state and the given configuration, ready right away
+    void restart(const sim800_emulator_config_t &c = sim800_emulator_config_t());
+
+    // send an unsolicited result code after the given time
+    void urc(const std::string &line, uint32_t after = 0);
+
+    // the remote side sends data on a link (0 in transparent mode), it arrives at the link rate
+    void push(uint8_t link, const std::string &data, uint32_t after = 0);
+
+    // the remote side closes a link
+    void close(uint8_t link);
+
+    // the network drops the PDP context or the bearer
+    void drop_pdp();
+    void drop_bearer();
+
+    // the chip is powered on and ready, and the fixed baud rate (0 while it detects the rate)
+    bool powered();
+    uint32_t baud();
+
+    // true while inside the emulator, e.g. to tell its heap use from the library's
+    bool busy();
+
+    // serial port side, called by SIM800EmulatorSerial
+    void begin(uint32_t rate);
+    int available();
+    int read();
+    int peek();
+    size_t write(const uint8_t *buffer, size_t size);
+
+    // pin side, called through the pin hooks of the shim
+    void pin(uint8_t pin, uint8_t value);
+    int pin(uint8_t pin);
+
+private:
+    struct byte_t {
+        uint64_t at;   // us when it is completely received
+        uint32_t rate; // baud rate it was sent with
+        uint8_t c;
+    };
+
+    enum mode_t {
+        COMMAND, SEND_DATA, HTTP_DATA, TRANSPARENT
+    };
+
+    int _busy = 0;
+    bool _in_event = false;
+    uint64_t _event_now = 0;
+    uint32_t _host_rate = 0;
+    uint32_t _rate = 0;       // fixed rate, 0 = auto detect
+    uint32_t _saved_rate = 0; // stored with AT&W
+    std::deque<byte_t> _out;
+    uint64_t _line_free = 0;  // when the chip can send the next byte
+    std::multimap<uint64_t, std::function<void()> > _events;
+
+    bool _powered = true;
+    uint64_t _ready_at = 0;
+    uint64_t _registered_at = 0;
+    uint64_t _key_low = 0;
+    bool _key_down = false;
+    bool _key_toggled = false;
+    bool _rst_low = false;
+
+    mode_t _mode = COMMAND;
+    std::string _command;
+    std::string _data;
+    size_t _data_left = 0;
+    uint8_t _data_link = 0;
+    bool _skip_lf = false;
+    uint8_t _plus = 0;
+    uint64_t _last_in = 0;
+    uint64_t _plus_at = 0;
+    bool _echo = true;
+
+    // network state
+    uint8_t _creg_mode = 0;
+    bool _attached = true;
+    bool _bearer = false;
+    uint8_t _ip = 0; // 0 = initial, 1 = start, 2 = gprsact, 3 = status
+    uint8_t _mux = 0;
+    uint8_t _cipmode = 0;
+    uint8_t _rxget = 0;
+    uint8_t _qsend = 0;
+    uint8_t _links = 0;
+    std::string _link_host[SIM800_EMULATOR_LINKS];
+    std::string _link_rx[SIM800_EMULATOR_LINKS];
+    uint32_t _link_sent[SIM800_EMULATOR_LINKS] = {};
+    uint64_t _uplink_free = 0;
+    uint64_t _downlink_free = 0;
+
+    // HTTP state
+    bool _http = false;
+    std::map<std::string, std::string> _http_para;
+    std::string _http_data;
+    std::string _http_response;
+
+    // the time of the event being run, or the current time
+    uint64_t now();
+
+    uint32_t byte_time(uint32_t rate);
+
+    // run the events that are due
+    void service();
+
+    void at(uint64_t time, std::function<void()> event);
+
+    // put data on the line right away, or after the given ms
+    void put(const std::string &data);
+    void emit(const std::string &data, uint32_t after = 0);
+
+    // answer a command after the chip latency and the given ms
+    void reply(const std::string &line, uint32_t after = 0);
+    void reply_ok(const std::string &line, uint32_t after = 0);
+
+    void boot();
+
+    void power_off();
+
+    void receive(uint8_t c);
+
+    void command(const std::string &line);
+
+    // the data announced with AT+CIPSEND or AT+HTTPDATA is complete
+    void data_done();
+
+    bool registered();
+
+    // when bytes sent over the cell link are through, free is when the link is idle again
+    uint64_t link_time(uint64_t &free, size_t bytes);
+
+    uint16_t serve(const sim800_emulator_request_t &request, std::string &response);
+};
+
+SIM800Emulator &sim800_emulator();
+
+// the serial port handed to the library, all copies talk to the one emulator
+class SIM800EmulatorSerial : public Stream {
+public:
+    void begin(uint32_t rate) { sim800_emulator().begin(rate); }
+
+    virtual int available() { return sim800_emulator().available(); }
+
+    virtual int read() { return sim800_emulator().read(); }
+
+    virtual int peek() { return sim800_emulator().peek(); }
+
+    virtual size_t write(uint8_t c) { return sim800_emulator().write(&c, 1); }
+
+    virtual size_t write(const uint8_t *buffer, size_t size) { return sim800_emulator().write(buffer, size); }
+
+    using Print::write;
+};
+
+#endif //SIM800_EMULATOR_H
@@ -0,0 +1,81 @@
+/**
+ * Minimal Arduino API to build the library on the host.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Arduino.h"
+
+static uint64_t _now = 0;
+static uint8_t _pins[64] = {};
+static int _debug = -1;
+
+host_pin_hooks_t host_pin_hooks = {NULL, NULL};
+void (*host_yield_hook)() = NULL;
+
+HardwareSerial Serial;
+
+uint64_t host_time() {
+  return _now;
+}
+
+void host_advance(uint64_t us) {
+  _now += us;
+}
+
+unsigned long millis() {
+  _now += HOST_TICK_US;
+  return (unsigned long) (_now / 1000);
+}
+
+unsigned long micros() {
+  _now += HOST_TICK_US;
+  return (unsigned long) _now;
+}
+
+void delay(unsigned long ms) {
+  _now += (uint64_t) ms * 1000;
+  yield();
+}
+
+void delayMicroseconds(unsigned int us) {
+  _now += us;
+}
+
+void yield() {
+  if (host_yield_hook) host_yield_hook();
+}
+
+void pinMode(uint8_t, uint8_t) { }
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  _pins[pin % sizeof(_pins)] = value;
+  if (host_pin_hooks.write) host_pin_hooks.write(pin, value);
+}
+
+int digitalRead(uint8_t pin) {
+  int value = host_pin_hooks.read ? host_pin_hooks.read(pin) : -1;
+  if (value >= 0) return value;
+  return _pins[pin % sizeof(_pins)];
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (_debug < 0) _debug = getenv("SIM800_HOST_DEBUG") != NULL;
+  if (_debug) fputc(c, stderr);
+  return 1;
+}
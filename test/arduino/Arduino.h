@@ -0,0 +1,120 @@
+/**
+ * Minimal Arduino API to build the library on the host.
+ *
+ * Time is virtual: it only advances when the code asks for it (each
+ * call of millis() or micros() costs HOST_TICK_US) or waits with
+ * delay(), so a test runs as fast as the host allows and gives the
+ * same results on every run. The pins are plain variables, a
+ * simulated device can hook into them.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Print.h"
+#include "Stream.h"
+
+// the time a call of millis() or micros() takes, so busy loops see the time pass
+#ifndef HOST_TICK_US
+#define HOST_TICK_US 2
+#endif
+
+// the host has no separate flash address space
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *) (p))
+#define pgm_read_word(p) (*(const uint16_t *) (p))
+#define pgm_read_dword(p) (*(const uint32_t *) (p))
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strlen_P strlen
+#define strstr_P strstr
+#define memcpy_P memcpy
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+// functions, not macros, so the standard library headers still work
+template<typename T>
+inline T min(T a, T b) { return a < b ? a : b; }
+
+template<typename T>
+inline T max(T a, T b) { return a > b ? a : b; }
+
+unsigned long millis();
+
+unsigned long micros();
+
+void delay(unsigned long ms);
+
+void delayMicroseconds(unsigned int us);
+
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+
+void digitalWrite(uint8_t pin, uint8_t value);
+
+int digitalRead(uint8_t pin);
+
+// virtual time in us since the start, without advancing it
+uint64_t host_time();
+
+// let time pass, e.g. for work done outside the library
+void host_advance(uint64_t us);
+
+// a simulated device can take over pins, write is called after the pin changed,
+// read returns the level of the pins it drives and -1 for the others
+struct host_pin_hooks_t {
+    void (*write)(uint8_t pin, uint8_t value);
+    int (*read)(uint8_t pin);
+};
+extern host_pin_hooks_t host_pin_hooks;
+
+// called by yield() and after delay(), so a simulated device catches up with the time that passed
+extern void (*host_yield_hook)();
+
+// the debug port, discards the output unless SIM800_HOST_DEBUG is set in the environment
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) { }
+
+    virtual int available() { return 0; }
+
+    virtual int read() { return -1; }
+
+    virtual int peek() { return -1; }
+
+    virtual size_t write(uint8_t c);
+
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif //HOST_ARDUINO_H
@@ -0,0 +1,89 @@
+/**
+ * Host replacement for the Arduino Print class, enough to build the
+ * library and the tests on Linux.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEC 10
+#define HEX 16
+
+class Print {
+public:
+    virtual ~Print() { }
+
+    virtual size_t write(uint8_t c) = 0;
+
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (n < size && write(buffer[n])) n++;
+        return n;
+    }
+
+    size_t write(const char *s) { return s ? write((const uint8_t *) s, strlen(s)) : 0; }
+
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *) buffer, size); }
+
+    virtual void flush() { }
+
+    size_t print(const char *s) { return write(s); }
+
+    size_t print(char c) { return write((uint8_t) c); }
+
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long) n, base); }
+
+    size_t print(int n, int base = DEC) { return print((long) n, base); }
+
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long) n, base); }
+
+    size_t print(long n, int base = DEC) {
+        char s[24];
+        snprintf(s, sizeof(s), base == HEX ? "%lx" : "%ld", n);
+        return write(s);
+    }
+
+    size_t print(unsigned long n, int base = DEC) {
+        char s[24];
+        snprintf(s, sizeof(s), base == HEX ? "%lx" : "%lu", n);
+        return write(s);
+    }
+
+    size_t print(double n, int digits = 2) {
+        char s[32];
+        snprintf(s, sizeof(s), "%.*f", digits, n);
+        return write(s);
+    }
+
+    size_t println() { return write("\r\n"); }
+
+    template<typename T>
+    size_t println(T value) { return print(value) + println(); }
+
+    template<typename T>
+    size_t println(T value, int format) { return print(value, format) + println(); }
+};
+
+#endif //HOST_PRINT_H
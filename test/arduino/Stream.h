@@ -0,0 +1,65 @@
+/**
+ * Host replacement for the Arduino Stream class.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include "Print.h"
+
+unsigned long millis();
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+
+    virtual int read() = 0;
+
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+    // like the Arduino version, waits up to the timeout for each byte
+    size_t readBytes(char *buffer, size_t length) {
+        size_t n = 0;
+        while (n < length) {
+            int c = timedRead();
+            if (c < 0) break;
+            buffer[n++] = (char) c;
+        }
+        return n;
+    }
+
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *) buffer, length); }
+
+protected:
+    unsigned long _timeout = 1000;
+
+    int timedRead() {
+        unsigned long started = millis();
+        do {
+            int c = read();
+            if (c >= 0) return c;
+        } while (millis() - started < _timeout);
+        return -1;
+    }
+};
+
+#endif //HOST_STREAM_H
@@ -0,0 +1,60 @@
+/**
+ * Host timing of the response parsers against sscanf.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include "../src/UbirchSIM800.cpp"
+#include "sim800_test.h"
+
+#define ROUNDS 1000000
+
+static double ns_per_round(std::chrono::steady_clock::time_point started) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / ROUNDS;
+}
+
+int main() {
+  // the compiler must not see the constant
+  static volatile const char *volatile response = "+HTTPACTION: 0,200,123456";
+  const char *line = (const char *) response;
+  uint64_t sum = 0;
+
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ROUNDS; i++) {
+    const char *p = line + 13;
+    uint32_t method = 0, status = 0, length = 0;
+    if (scan_number(p, method) && scan_next(p, status) && scan_next(p, length)) sum += method + status + length;
+  }
+  double scan_ns = ns_per_round(started);
+  CHECK_EQUAL((uint64_t) ROUNDS * 123656, sum);
+
+  sum = 0;
+  started = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ROUNDS; i++) {
+    unsigned method = 0, status = 0, length = 0;
+    if (sscanf(line, "+HTTPACTION: %u,%u,%u", &method, &status, &length) == 3) sum += method + status + length;
+  }
+  double sscanf_ns = ns_per_round(started);
+  CHECK_EQUAL((uint64_t) ROUNDS * 123656, sum);
+
+  printf("parse \"%s\": scan_number %.1f ns, sscanf %.1f ns (host)\n", line, scan_ns, sscanf_ns);
+  CHECK(scan_ns < sscanf_ns);
+  return sim800_test_result();
+}
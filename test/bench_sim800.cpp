@@ -0,0 +1,212 @@
+/**
+ * Benchmarks on the virtual clock of the emulator: time, AT round trips
+ * and bytes on the serial line of the common operations.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include "UbirchSIM800.h"
+#include "sim800_test.h"
+
+static SIM800Emulator &chip = sim800_emulator();
+
+// exposes the URC matcher
+class BenchSIM800 : public UbirchSIM800 {
+public:
+    using UbirchSIM800::is_urc;
+};
+
+struct measurement {
+    double started;
+    uint32_t commands, tx, rx;
+
+    measurement() : started(sim800_test_ms()), commands(chip.commands), tx(chip.tx_bytes), rx(chip.rx_bytes) { }
+
+    void report(const char *name) {
+      printf("%-34s %9.1f ms %4u cmds %8u tx %8u rx\n", name, sim800_test_ms() - started,
+             chip.commands - commands, chip.tx_bytes - tx, chip.rx_bytes - rx);
+    }
+};
+
+static bool online(BenchSIM800 &sim) {
+  sim.setAPN(F("internet"), NULL, NULL);
+  return sim.reset() && sim.registerNetwork() && sim.enableGPRS();
+}
+
+static void bench_session() {
+  chip.restart();
+  BenchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset());
+  CHECK(sim.registerNetwork());
+  measurement gprs;
+  CHECK(sim.enableGPRS());
+  gprs.report("enableGPRS");
+  measurement again;
+  CHECK(sim.enableGPRS());
+  again.report("enableGPRS (bearer up)");
+
+  unsigned long length;
+  chip.http_body = sim800_test_data(10000);
+  SIM800TestStream file;
+  measurement get;
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length, file));
+  get.report("HTTP_get 10 KB");
+  measurement get_again;
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length, file));
+  get_again.report("HTTP_get 10 KB (session kept)");
+
+  SIM800TestStream upload(sim800_test_data(10000, 2));
+  measurement post;
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, upload, 10000));
+  post.report("HTTP_post 10 KB");
+
+  measurement open;
+  CHECK_EQUAL(0, sim.open("example.com", 7));
+  open.report("open");
+  std::string data = sim800_test_data(10000, 3);
+  unsigned long accepted;
+  measurement send;
+  CHECK(sim.send(0, (char *) data.data(), data.size(), accepted));
+  CHECK(sim.send_flush(0));
+  send.report("send 10 KB");
+  chip.push(0, data);
+  std::string received;
+  char buffer[4096];
+  measurement receive;
+  while (received.size() < data.size()) {
+    size_t n = sim.receive(0, buffer, sizeof(buffer), 2000);
+    if (!n) break;
+    received.append(buffer, n);
+  }
+  receive.report("receive 10 KB");
+  CHECK(received == data);
+  CHECK(sim.disconnect(0));
+}
+
+// the callback does not advance the clock, the application work is not charged to the download
+static uint32_t idle_calls = 0;
+static unsigned long idle_last = 0, idle_gap = 0;
+
+static void idle_work() {
+  unsigned long now = micros();
+  if (idle_calls && now - idle_last > idle_gap) idle_gap = now - idle_last;
+  idle_last = now;
+  idle_calls++;
+}
+
+static void bench_idle() {
+  chip.restart();
+  BenchSIM800 sim;
+  CHECK(online(sim));
+  chip.http_body = sim800_test_data(300000);
+  SIM800TestStream file;
+  file.data.reserve(300000);
+  sim800_download_t progress = {0, 0, 0};
+  sim.setIdleCallback(idle_work);
+  idle_calls = 0;
+  idle_gap = 0;
+  measurement download;
+  CHECK_EQUAL(200, sim.HTTP_download("http://example.com/fw", progress, file));
+  download.report("HTTP_download 300 KB");
+  double total = sim800_test_ms() - download.started;
+  printf("  idle callback: %u calls, %.1f per ms, the application waited at most %.1f ms\n",
+         idle_calls, idle_calls / total, idle_gap / 1000.0);
+  CHECK(file.data == chip.http_body);
+  CHECK(idle_calls > 0);
+}
+
+static void bench_transparent() {
+  chip.restart();
+  BenchSIM800 sim;
+  CHECK(online(sim));
+  std::string data = sim800_test_data(20000, 4);
+  unsigned long accepted;
+
+  CHECK_EQUAL(0, sim.open("example.com", 7));
+  measurement command;
+  CHECK(sim.send(0, (char *) data.data(), data.size(), accepted));
+  CHECK(sim.send_flush(0));
+  double command_ms = sim800_test_ms() - command.started;
+  command.report("command mode send 20 KB");
+
+  Stream *socket = sim.connectTransparent("example.com", 7);
+  CHECK(socket != NULL);
+  if (!socket) return;
+  measurement transparent;
+  socket->write((const uint8_t *) data.data(), data.size());
+  double transparent_ms = sim800_test_ms() - transparent.started;
+  transparent.report("transparent send 20 KB");
+  printf("  %.0f vs %.0f bytes/s\n", data.size() / command_ms * 1000, data.size() / transparent_ms * 1000);
+  CHECK(sim.disconnectTransparent());
+  CHECK(chip.remote[0] == data);
+}
+
+static void bench_baud() {
+  static const uint32_t rates[] = {115200, 230400, 460800};
+  for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+    sim800_emulator_config_t config;
+    config.link_rate = 100000;
+    chip.restart(config);
+    BenchSIM800 sim;
+    CHECK(online(sim));
+    CHECK_EQUAL(rates[i], sim.negotiateBaud(rates[i], false));
+    chip.http_body = sim800_test_data(50000);
+    SIM800TestStream file;
+    unsigned long length;
+    char name[40];
+    snprintf(name, sizeof(name), "HTTP_get 50 KB at %u baud", rates[i]);
+    measurement get;
+    CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length, file));
+    get.report(name);
+    CHECK(file.data == chip.http_body);
+  }
+}
+
+static void bench_urc() {
+  static const char *const lines[] = {
+      "OK", "+HTTPACTION: 0,200,1000", "+CIPRXGET: 1,0", "DATA ACCEPT:0,1460", "0, CLOSED",
+      "+CREG: 1,\"1A2B\",\"3C4D\"", "NORMAL POWER DOWN", "+PDP: DEACT", "C: 0,0,\"TCP\"", "SHUT OK"
+  };
+  const size_t count = sizeof(lines) / sizeof(lines[0]);
+  size_t lengths[count];
+  for (size_t i = 0; i < count; i++) lengths[i] = strlen(lines[i]);
+
+  chip.restart();
+  BenchSIM800 sim;
+  const uint32_t rounds = 200000;
+  uint32_t matched = 0;
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < count; i++) matched += sim.is_urc(lines[i], lengths[i]);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+  printf("is_urc: %.1f ns per line (host), %u of %u lines are URCs\n", ns / rounds / count,
+         matched / rounds, (unsigned) count);
+  CHECK_EQUAL(6 * rounds, matched);
+}
+
+int main() {
+  bench_session();
+  bench_idle();
+  bench_transparent();
+  bench_baud();
+  bench_urc();
+  return sim800_test_result();
+}
@@ -0,0 +1,51 @@
+/**
+ * A storage region in RAM for the log and batch tests.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM800_RAM_STORAGE_H
+#define SIM800_RAM_STORAGE_H
+
+#include <vector>
+#include "UbirchSIM800Log.h"
+
+// writes fail after a simulated power loss
+class SIM800RAMStorage : public UbirchSIM800Storage {
+public:
+    std::vector<uint8_t> data;
+    bool power = true;
+
+    SIM800RAMStorage(size_t size) : data(size, 0xff) { }
+
+    virtual uint32_t size() { return (uint32_t) data.size(); }
+
+    virtual bool read(uint32_t address, uint8_t *buffer, size_t length) {
+      if (address + length > data.size()) return false;
+      memcpy(buffer, data.data() + address, length);
+      return true;
+    }
+
+    virtual bool write(uint32_t address, const uint8_t *buffer, size_t length) {
+      if (address + length > data.size()) return false;
+      if (power) memcpy(data.data() + address, buffer, length);
+      return power;
+    }
+};
+
+#endif //SIM800_RAM_STORAGE_H
@@ -0,0 +1,32 @@
+/**
+ * Serial port of the replay build: plays back the trace the traced
+ * build recorded (see test_trace.cpp and test_replay.cpp).
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM800_REPLAY_H
+#define SIM800_REPLAY_H
+
+#include "UbirchSIM800Replay.h"
+
+// the trace, loaded before the driver is constructed
+extern const uint8_t *sim800_replay_trace;
+extern size_t sim800_replay_size;
+
+#endif //SIM800_REPLAY_H
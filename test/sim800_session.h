@@ -0,0 +1,54 @@
+/**
+ * The session recorded by test_trace and played back by test_replay.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM800_SESSION_H
+#define SIM800_SESSION_H
+
+#include "UbirchSIM800.h"
+#include "sim800_test.h"
+
+// reset, register, GET, POST and a TCP round trip, the checks hold for both the emulator and the replay
+static void sim800_session(UbirchSIM800 &sim) {
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset());
+  CHECK(sim.registerNetwork());
+  CHECK(sim.enableGPRS());
+
+  unsigned long length = 0;
+  SIM800TestStream file;
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length, file));
+  CHECK(file.data == sim800_test_data(2000));
+
+  SIM800TestStream upload(sim800_test_data(1000, 2));
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, upload, 1000));
+
+  CHECK_EQUAL(0, sim.open("example.com", 7));
+  std::string data = sim800_test_data(500, 3);
+  unsigned long accepted;
+  CHECK(sim.send(0, (char *) data.data(), data.size(), accepted));
+  CHECK(sim.send_flush(0));
+  char buffer[600];
+  CHECK_EQUAL(data.size(), sim.receive(0, buffer, sizeof(buffer), 2000));
+  CHECK(!memcmp(buffer, data.data(), data.size()));
+  CHECK(sim.disconnect(0));
+}
+
+#endif //SIM800_SESSION_H
@@ -0,0 +1,97 @@
+/**
+ * Helpers shared by the host tests and benchmarks.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM800_TEST_H
+#define SIM800_TEST_H
+
+#include <stdio.h>
+#include <string>
+#include <Arduino.h>
+
+// the library prints debug output to Serial, so the tests report on stdout and count failures
+static int sim800_test_failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+      sim800_test_failures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQUAL(expected, actual) do { \
+    unsigned long long _e = (unsigned long long) (expected), _a = (unsigned long long) (actual); \
+    if (_e != _a) { \
+      printf("%s:%d: CHECK failed: %s == %s (%llu != %llu)\n", __FILE__, __LINE__, #expected, #actual, _e, _a); \
+      sim800_test_failures++; \
+    } \
+  } while (0)
+
+// the exit code of a test
+static inline int sim800_test_result() {
+  printf("%s\n", sim800_test_failures ? "FAILED" : "PASSED");
+  return sim800_test_failures ? 1 : 0;
+}
+
+// collects what is written to it, reads back what is put into data
+class SIM800TestStream : public Stream {
+public:
+    std::string data;
+    size_t pos = 0;
+
+    SIM800TestStream() { }
+
+    SIM800TestStream(const std::string &data) : data(data) { }
+
+    virtual int available() { return (int) min(data.size() - pos, (size_t) 0x7fff); }
+
+    virtual int read() { return pos < data.size() ? (uint8_t) data[pos++] : -1; }
+
+    virtual int peek() { return pos < data.size() ? (uint8_t) data[pos] : -1; }
+
+    virtual size_t write(uint8_t c) {
+        data += (char) c;
+        return 1;
+    }
+
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        data.append((const char *) buffer, size);
+        return size;
+    }
+
+    using Print::write;
+};
+
+// reproducible test data, text repeats like telemetry does
+static inline std::string sim800_test_data(size_t size, uint32_t seed = 1) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    seed = seed * 1103515245UL + 12345UL;
+    data[i] = (char) (seed >> 16);
+  }
+  return data;
+}
+
+// virtual time in ms
+static inline double sim800_test_ms() {
+  return host_time() / 1000.0;
+}
+
+#endif //SIM800_TEST_H
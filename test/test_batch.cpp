@@ -0,0 +1,180 @@
+/**
+ * The batch scheduler: thresholds, one session per batch and payloads
+ * kept in RAM or in a storage region until the server took them.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <vector>
+#include "UbirchSIM800Batch.h"
+#include "sim800_ram_storage.h"
+#include "sim800_test.h"
+
+static SIM800Emulator &chip = sim800_emulator();
+
+// the bodies the server got, and what it answers
+static std::vector<std::string> bodies;
+static uint16_t answer = 200;
+
+static uint16_t server(const sim800_emulator_request_t &request, std::string &) {
+  if (answer == 200) bodies.push_back(request.body);
+  return answer;
+}
+
+static void start() {
+  chip.restart();
+  chip.http = server;
+  bodies.clear();
+  answer = 200;
+}
+
+static std::string payload(uint32_t n) {
+  char s[32];
+  snprintf(s, sizeof(s), "{\"n\":%u}", n);
+  return s;
+}
+
+static void test_ram() {
+  start();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  UbirchSIM800Batch batch(sim, "http://example.com/batch");
+  batch.setThresholds(10, 3600000UL, 200);
+
+  CHECK(!batch.due());
+  CHECK(batch.add(payload(1).data(), payload(1).size()));
+  CHECK(!batch.due());
+  CHECK(batch.add(payload(2).data(), payload(2).size()));
+  CHECK(batch.due());
+  CHECK_EQUAL(2, batch.pending());
+  CHECK_EQUAL(2, batch.run());
+  CHECK_EQUAL(0, batch.pending());
+  CHECK_EQUAL(2, bodies.size());
+  CHECK(bodies.size() == 2 && bodies[0] == payload(1) && bodies[1] == payload(2));
+  // one session for the batch
+  CHECK_EQUAL(1, batch.stats().sessions);
+  CHECK_EQUAL(1, std::count(chip.log.begin(), chip.log.end(), "AT+HTTPINIT"));
+  CHECK(!chip.powered());
+
+  // a priority payload is sent right away
+  CHECK(batch.add("{}", 2, 250));
+  CHECK(batch.due());
+}
+
+static void test_store() {
+  start();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  UbirchSIM800Batch batch(sim, "http://example.com/batch");
+
+  // room for a few payloads only, so the ring wraps around
+  SIM800RAMStorage storage(40);
+  batch.setStore(&storage);
+  uint32_t next = 0, expected = 0;
+  for (int round = 0; round < 3; round++) {
+    while (batch.add(payload(next).data(), payload(next).size())) next++;
+    CHECK_EQUAL(next - expected, batch.pending());
+    CHECK_EQUAL(round + 1, batch.stats().dropped);
+
+    // the server is down, nothing is lost
+    answer = 503;
+    CHECK_EQUAL(0, batch.flush());
+    CHECK_EQUAL(next - expected, batch.pending());
+
+    answer = 200;
+    CHECK_EQUAL(next - expected, batch.flush());
+    CHECK_EQUAL(0, batch.pending());
+    for (; expected < next; expected++) {
+      CHECK(expected < bodies.size() && bodies[expected] == payload(expected));
+    }
+  }
+  CHECK_EQUAL(next, bodies.size());
+  CHECK_EQUAL(next, batch.stats().payloads);
+}
+
+static void test_refused() {
+  start();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  UbirchSIM800Batch batch(sim, "http://example.com/batch");
+  SIM800RAMStorage storage(64);
+
+  // the server refuses the second payload in RAM and the first in the store
+  chip.http = [](const sim800_emulator_request_t &request, std::string &) -> uint16_t {
+    if (request.body == payload(2) || request.body == payload(4)) return 400;
+    bodies.push_back(request.body);
+    return 200;
+  };
+  for (uint32_t n = 1; n <= 3; n++) CHECK(batch.add(payload(n).data(), payload(n).size()));
+  batch.setStore(&storage);
+  for (uint32_t n = 4; n <= 5; n++) CHECK(batch.add(payload(n).data(), payload(n).size()));
+
+  // refused payloads are dropped, the rest of the batch is still sent
+  CHECK_EQUAL(3, batch.flush());
+  CHECK_EQUAL(0, batch.pending());
+  CHECK_EQUAL(0, batch.pending_bytes());
+  CHECK_EQUAL(2, batch.stats().dropped);
+  CHECK_EQUAL(3, batch.stats().payloads);
+  CHECK(bodies.size() == 3 && bodies[0] == payload(1) && bodies[1] == payload(3) && bodies[2] == payload(5));
+  CHECK(!batch.due());
+}
+
+static void test_recount() {
+  start();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  UbirchSIM800Batch batch(sim, "http://example.com/batch");
+  batch.setThresholds(1000, 3600000UL, 200);
+
+  // the priority payload goes through, the other one has to wait
+  chip.http = [](const sim800_emulator_request_t &request, std::string &) -> uint16_t {
+    return request.body == payload(1) ? 200 : 503;
+  };
+  CHECK(batch.add(payload(1).data(), payload(1).size(), 250));
+  host_advance(3000000000ULL);
+  CHECK(batch.add(payload(2).data(), payload(2).size()));
+  CHECK(batch.due());
+  CHECK_EQUAL(1, batch.flush());
+  CHECK_EQUAL(1, batch.pending());
+  CHECK_EQUAL(payload(2).size(), batch.pending_bytes());
+
+  // neither the priority nor the age of the payload that was sent keep the batch due
+  host_advance((SIM800_BATCH_RETRY + 1200000UL) * 1000ULL);
+  CHECK(!batch.due());
+  host_advance(2400000000ULL);
+  CHECK(batch.due());
+
+  // a new store drops what was left in the previous one, the RAM queue stays
+  SIM800RAMStorage storage(64), other(64);
+  batch.setStore(&storage);
+  CHECK(batch.add(payload(3).data(), payload(3).size()));
+  CHECK_EQUAL(2, batch.pending());
+  batch.setStore(&other);
+  CHECK_EQUAL(1, batch.pending());
+  CHECK_EQUAL(payload(2).size(), batch.pending_bytes());
+  CHECK_EQUAL(1, batch.stats().dropped);
+}
+
+int main() {
+  test_ram();
+  test_store();
+  test_refused();
+  test_recount();
+  return sim800_test_result();
+}
@@ -0,0 +1,131 @@
+/**
+ * LZSS compression of uploads: round trips through an independent
+ * heatshrink decoder, the compression ratio of telemetry and the time
+ * it saves on the cell link.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UbirchSIM800Compressor.h"
+#include "sim800_test.h"
+
+static SIM800Emulator &chip = sim800_emulator();
+
+// line delimited JSON like a sensor node sends it
+static std::string telemetry(size_t size) {
+  std::string data;
+  char line[128];
+  for (uint32_t i = 0; data.size() < size; i++) {
+    snprintf(line, sizeof(line),
+             "{\"ts\":%u,\"temp\":%.1f,\"hum\":%u,\"bat\":%u,\"lat\":52.520008,\"lon\":13.404954,\"rssi\":-%u}\n",
+             1461500000 + i * 60, 21.5 + (i % 7) * 0.1, 40 + i % 5, 4112 - i / 10, 60 + i % 13);
+    data += line;
+  }
+  data.resize(size);
+  return data;
+}
+
+// heatshrink decoder, written from the format description
+static std::string decompress(const std::string &in) {
+  std::string out;
+  size_t bit = 0, bits = in.size() * 8;
+  auto take = [&](uint8_t count) {
+    uint32_t v = 0;
+    while (count--) {
+      v = v << 1 | ((uint8_t) in[bit / 8] >> (7 - bit % 8) & 1);
+      bit++;
+    }
+    return v;
+  };
+  while (bits - bit >= 9) {
+    if (take(1)) {
+      out += (char) take(8);
+    } else {
+      if (bits - bit < SIM800_LZ_WINDOW_BITS + SIM800_LZ_LOOKAHEAD_BITS) break;
+      uint32_t distance = take(SIM800_LZ_WINDOW_BITS) + 1;
+      uint32_t length = take(SIM800_LZ_LOOKAHEAD_BITS) + 1;
+      if (distance > out.size()) return "<invalid back reference>";
+      for (uint32_t i = 0; i < length; i++) out += out[out.size() - distance];
+    }
+  }
+  return out;
+}
+
+static std::string compress(const std::string &data) {
+  SIM800TestStream source(data);
+  UbirchSIM800Compressor compressor(source, (uint32_t) data.size());
+  std::string out;
+  int c;
+  while ((c = compressor.read()) != -1) out += (char) c;
+  return out;
+}
+
+static void round_trip(const char *name, const std::string &data) {
+  std::string compressed = compress(data);
+  printf("%-10s %6u -> %6u bytes (%u%%)\n", name, (unsigned) data.size(), (unsigned) compressed.size(),
+         (unsigned) (data.size() ? compressed.size() * 100 / data.size() : 0));
+  CHECK(decompress(compressed) == data);
+
+  SIM800TestStream source(data);
+  CHECK_EQUAL(compressed.size(), UbirchSIM800Compressor::measure(source, (uint32_t) data.size()));
+}
+
+static void test_ratios() {
+  round_trip("empty", "");
+  round_trip("byte", "x");
+  round_trip("zeros", std::string(10000, '\0'));
+  round_trip("random", sim800_test_data(10000));
+
+  std::string json = telemetry(13000);
+  round_trip("telemetry", json);
+  CHECK(compress(json).size() < json.size() / 4);
+  CHECK(compress(sim800_test_data(10000)).size() <= 10000 * 9 / 8 + 1);
+}
+
+static void test_upload() {
+  chip.restart();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset() && sim.registerNetwork() && sim.enableGPRS());
+  unsigned long length;
+
+  std::string json = telemetry(13000);
+  SIM800TestStream raw(json);
+  double started = sim800_test_ms();
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, raw, (uint32_t) json.size()));
+  double raw_ms = sim800_test_ms() - started;
+
+  SIM800TestStream source(json);
+  uint32_t size = UbirchSIM800Compressor::measure(source, (uint32_t) json.size());
+  source.pos = 0;
+  UbirchSIM800Compressor body(source, (uint32_t) json.size());
+  started = sim800_test_ms();
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, body, size));
+  double compressed_ms = sim800_test_ms() - started;
+  CHECK(decompress(chip.requests.back().body) == json);
+
+  printf("post %u bytes raw: %.0f ms, compressed to %u bytes: %.0f ms (virtual, %u bytes/s uplink)\n",
+         (unsigned) json.size(), raw_ms, size, compressed_ms, chip.config.link_rate);
+  CHECK(compressed_ms < raw_ms);
+}
+
+int main() {
+  test_ratios();
+  test_upload();
+  return sim800_test_result();
+}
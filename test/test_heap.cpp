@@ -0,0 +1,89 @@
+/**
+ * The library does not use the heap: malloc, calloc and realloc are
+ * replaced and counted while the library runs a full cycle of
+ * transfers (calls made by the emulator are not counted).
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UbirchSIM800.h"
+#include "sim800_test.h"
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+
+static bool armed = false;
+static unsigned allocations = 0;
+
+static void count() {
+  if (armed && !sim800_emulator().busy()) allocations++;
+}
+
+extern "C" void *malloc(size_t size) {
+  count();
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  count();
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *p, size_t size) {
+  count();
+  return __libc_realloc(p, size);
+}
+
+static SIM800Emulator &chip = sim800_emulator();
+
+int main() {
+  chip.restart();
+  chip.http_body = sim800_test_data(5000);
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset() && sim.registerNetwork() && sim.enableGPRS());
+
+  // the sinks and sources of the test must not allocate either
+  SIM800TestStream file, upload(sim800_test_data(3000));
+  file.data.reserve(10000);
+  std::string answer = sim800_test_data(2000, 2);
+  char buffer[2000];
+  unsigned long length, accepted;
+  sim800_location_t location;
+
+  armed = true;
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length, file));
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, upload, 3000));
+  CHECK(sim.location(location));
+  int8_t link = sim.open("example.com", 80);
+  CHECK_EQUAL(0, link);
+  upload.pos = 0;
+  CHECK(sim.send(0, upload, accepted));
+  CHECK(sim.send_flush(0));
+  chip.push(0, answer);
+  CHECK_EQUAL(answer.size(), sim.receive(0, buffer, sizeof(buffer), 2000));
+  CHECK(sim.disconnect(0));
+  armed = false;
+
+  CHECK(file.data == chip.http_body);
+  CHECK(!memcmp(buffer, answer.data(), answer.size()));
+  printf("heap calls: %u\n", allocations);
+  CHECK_EQUAL(0, allocations);
+  return sim800_test_result();
+}
@@ -0,0 +1,295 @@
+/**
+ * Boot, network registration, GPRS and the HTTP requests against the
+ * emulated chip, including resumable downloads.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+#include "UbirchSIM800.h"
+#include "UbirchSIM800CBOR.h"
+#include "sim800_test.h"
+
+static SIM800Emulator &chip = sim800_emulator();
+
+// table driven, so it does not share any code with the bitwise one of the driver
+static uint32_t zlib_crc32(const std::string &data) {
+  static uint32_t table[256];
+  if (!table[1]) {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+  }
+  uint32_t crc = 0xffffffffUL;
+  for (size_t i = 0; i < data.size(); i++) crc = table[(crc ^ (uint8_t) data[i]) & 0xff] ^ (crc >> 8);
+  return crc ^ 0xffffffffUL;
+}
+
+static size_t sent(const char *prefix) {
+  size_t n = 0;
+  for (size_t i = 0; i < chip.log.size(); i++) n += chip.log[i].compare(0, strlen(prefix), prefix) == 0;
+  return n;
+}
+
+static bool online(UbirchSIM800 &sim) {
+  sim.setAPN(F("internet"), NULL, NULL);
+  return sim.reset() && sim.registerNetwork() && sim.enableGPRS();
+}
+
+static void queued(uint8_t event, const char *line, size_t len, void *ctx) {
+  if (event != SIM800_EVENT_TIMEOUT) ((std::vector<std::string> *) ctx)->push_back(std::string(line, len));
+}
+
+static void test_boot() {
+  chip.restart();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset());
+  CHECK(sim.boot_time() >= chip.config.boot);
+  CHECK(sim.registerNetwork());
+  CHECK(sim.registered());
+  CHECK(sim.enableGPRS());
+
+  // the bearer is still up, only its status is queried
+  size_t commands = chip.commands;
+  CHECK(sim.enableGPRS());
+  CHECK_EQUAL(commands + 1, chip.commands);
+
+  // a queued command with parameters
+  std::vector<std::string> lines;
+  CHECK(sim.queue_AT(F("+SAPBR"), NULL, queued, &lines, SIM800_SERIAL_TIMEOUT, "=2,1"));
+  while (sim.poll());
+  CHECK(chip.log.back() == "AT+SAPBR=2,1");
+  CHECK(lines.size() == 2 && lines[0] == "+SAPBR: 1,1,\"10.0.0.2\"" && lines[1] == "OK");
+
+  CHECK(sim.disableGPRS());
+  CHECK(!chip.log.empty() && chip.log.back() == "AT+CGATT=0");
+}
+
+static void test_get() {
+  chip.restart();
+  UbirchSIM800 sim;
+  CHECK(online(sim));
+  chip.http_body = sim800_test_data(5000);
+
+  unsigned long length = 0;
+  SIM800TestStream file;
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length, file));
+  CHECK_EQUAL(5000, length);
+  CHECK(file.data == chip.http_body);
+  CHECK(sim.transfer_rate() > 0);
+
+  // the HTTP session and the URL are kept for the next request
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length));
+  CHECK_EQUAL(1, sent("AT+HTTPINIT"));
+  CHECK_EQUAL(1, sent("AT+HTTPPARA=\"URL\""));
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/other", length));
+  CHECK_EQUAL(2, sent("AT+HTTPPARA=\"URL\""));
+  CHECK(chip.requests.back().url == "http://example.com/other");
+  // the same FNV-1a hash and length, still another URL
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/6hs3a", length));
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/esaac", length));
+  CHECK(chip.requests.back().url == "http://example.com/esaac");
+
+  chip.http_body.clear();
+  CHECK_EQUAL(404, sim.HTTP_get("http://example.com/missing", length));
+}
+
+static void test_lossy_line() {
+  chip.restart();
+  UbirchSIM800 sim;
+  CHECK(online(sim));
+  chip.http_body = sim800_test_data(5000, 5);
+
+  // the line loses bytes of answers longer than 300 bytes
+  chip.on_command = [](const std::string &command, std::string &reply) {
+    unsigned int start, size;
+    if (sscanf(command.c_str(), "AT+HTTPREAD=%u,%u", &start, &size) != 2 || size <= 300) return false;
+    reply = "\r\n+HTTPREAD: " + std::to_string(size) + "\r\n" + chip.http_body.substr(start, 300) + "\r\nOK\r\n";
+    return true;
+  };
+  unsigned long length = 0;
+  SIM800TestStream file;
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length, file));
+  CHECK(file.data == chip.http_body);
+  chip.on_command = NULL;
+}
+
+static void encode(Print &out, void *ctx) {
+  UbirchSIM800CBOR cbor(out);
+  cbor.map(2);
+  cbor.text("t");
+  cbor.integer(*(int32_t *) ctx);
+  cbor.text("ok");
+  cbor.boolean(true);
+}
+
+static void test_post() {
+  chip.restart();
+  UbirchSIM800 sim;
+  CHECK(online(sim));
+  unsigned long length;
+
+  std::string data = sim800_test_data(3000);
+  std::vector<char> buffer(data.begin(), data.end());
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, buffer.data(), (uint32_t) buffer.size()));
+  CHECK(chip.requests.back().method == 1 && chip.requests.back().body == data);
+
+  SIM800TestStream file(sim800_test_data(10000, 2));
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, file, 10000));
+  CHECK(chip.requests.back().body == file.data);
+
+  // a short stream is padded and not posted
+  SIM800TestStream short_file(sim800_test_data(100));
+  CHECK_EQUAL(1009, sim.HTTP_post("http://example.com/in", length, short_file, 200));
+
+  int32_t t = -5;
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, encode, &t));
+  const char cbor[] = "\xa2\x61t\x24\x62ok\xf5";
+  CHECK(chip.requests.back().body == std::string(cbor, sizeof(cbor) - 1));
+  CHECK_EQUAL(sizeof(cbor) - 1, sim.stats().http_tx - 13100);
+}
+
+static std::vector<uint32_t> progress_offsets;
+
+static void progress(const sim800_download_t &p, void *) {
+  progress_offsets.push_back(p.offset);
+}
+
+static void test_download() {
+  chip.restart();
+  UbirchSIM800 sim;
+  CHECK(online(sim));
+
+  // larger than the chip can handle in one request
+  chip.http_body = sim800_test_data(600000);
+  SIM800TestStream file;
+  sim800_download_t p = {0, 0, 0};
+  progress_offsets.clear();
+  CHECK_EQUAL(200, sim.HTTP_download("http://example.com/fw", p, file, progress));
+  CHECK_EQUAL(600000, p.offset);
+  CHECK_EQUAL(600000, p.size);
+  CHECK_EQUAL(zlib_crc32(chip.http_body), p.crc);
+  CHECK(file.data == chip.http_body);
+  CHECK_EQUAL(3, chip.requests.size());
+  CHECK(chip.requests[1].userdata == "Range: bytes=262144-524287");
+  CHECK_EQUAL(3, progress_offsets.size());
+  // the range is not used for the next request
+  CHECK(chip.log.back() == "AT+HTTPPARA=\"USERDATA\",\"\"");
+
+  // a file of a multiple of the range size ends with a 416
+  chip.requests.clear();
+  chip.http_body = sim800_test_data(3000, 3);
+  file.data.clear();
+  p = {0, 0, 0};
+  CHECK_EQUAL(200, sim.HTTP_download("http://example.com/fw", p, file, NULL, NULL, 1000));
+  CHECK_EQUAL(3000, p.size);
+  CHECK(file.data == chip.http_body);
+  CHECK_EQUAL(4, chip.requests.size());
+
+  // a server that ignores the range sends the whole file
+  chip.requests.clear();
+  chip.http = [](const sim800_emulator_request_t &, std::string &response) -> uint16_t {
+    response = sim800_emulator().http_body;
+    return 200;
+  };
+  file.data.clear();
+  p = {0, 0, 0};
+  CHECK_EQUAL(200, sim.HTTP_download("http://example.com/fw", p, file, NULL, NULL, 1000));
+  CHECK(file.data == chip.http_body);
+  CHECK_EQUAL(1, chip.requests.size());
+
+  // refused by the server, no retries
+  chip.requests.clear();
+  chip.http = [](const sim800_emulator_request_t &, std::string &) -> uint16_t { return 403; };
+  p = {0, 0, 0};
+  CHECK_EQUAL(403, sim.HTTP_download("http://example.com/fw", p, file));
+  CHECK_EQUAL(1, chip.requests.size());
+  chip.http = NULL;
+}
+
+static void test_download_resume() {
+  chip.restart();
+  UbirchSIM800 sim;
+  CHECK(online(sim));
+  chip.http_body = sim800_test_data(20000, 4);
+
+  // the connection breaks down in the middle of the second range
+  int reads = 0;
+  chip.on_command = [&reads](const std::string &command, std::string &reply) {
+    if (command.compare(0, 12, "AT+HTTPREAD=") || ++reads != 14) return false;
+    sim800_emulator().drop_bearer();
+    reply = "\r\nERROR\r\n";
+    return true;
+  };
+
+  SIM800TestStream file;
+  sim800_download_t p = {0, 0, 0};
+  progress_offsets.clear();
+  CHECK_EQUAL(200, sim.HTTP_download("http://example.com/fw", p, file, progress, NULL, 10000));
+  CHECK(file.data == chip.http_body);
+  CHECK_EQUAL(zlib_crc32(chip.http_body), p.crc);
+  // the bearer was brought up again
+  CHECK_EQUAL(2, sent("AT+SAPBR=1,1"));
+  CHECK(progress_offsets.size() >= 3);
+  CHECK(chip.requests.size() >= 3 && chip.requests[2].userdata == "Range: bytes=13072-23071");
+
+  // a reset in between, continue with the saved progress
+  chip.on_command = NULL;
+  sim800_download_t saved = {4096, 0, zlib_crc32(chip.http_body.substr(0, 4096))};
+  file.data = chip.http_body.substr(0, 4096);
+  UbirchSIM800 again;
+  CHECK(online(again));
+  CHECK_EQUAL(200, again.HTTP_download("http://example.com/fw", saved, file));
+  CHECK(file.data == chip.http_body);
+  CHECK_EQUAL(zlib_crc32(chip.http_body), saved.crc);
+}
+
+static void test_persisted_baud() {
+  chip.restart();
+  {
+    UbirchSIM800 sim;
+    sim.setAPN(F("internet"), NULL, NULL);
+    CHECK(sim.reset());
+    CHECK_EQUAL(460800, sim.negotiateBaud(SIM800_BAUD_MAX, true));
+  }
+
+  // the MCU restarts and expects the default rate, the chip keeps running with the stored one
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  double started = sim800_test_ms();
+  CHECK(sim.wakeup());
+  CHECK(sim800_test_ms() - started < SIM800_BOOT_TIMEOUT / 2);
+  CHECK(!sent("AT+CPOWD"));
+  CHECK(chip.powered());
+  CHECK_EQUAL(460800, chip.baud());
+  CHECK(sim.registerNetwork());
+}
+
+int main() {
+  test_boot();
+  test_get();
+  test_lossy_line();
+  test_post();
+  test_download();
+  test_download_resume();
+  test_persisted_baud();
+  return sim800_test_result();
+}
@@ -0,0 +1,171 @@
+/**
+ * The store-and-forward log on a RAM region: appending, recovery after a
+ * power loss and forwarding to a server that checks the framing.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <set>
+#include "sim800_ram_storage.h"
+#include "sim800_test.h"
+
+#define RECORDS 10000
+#define RECORD_SIZE 32
+
+static SIM800Emulator &chip = sim800_emulator();
+
+static double real_ms(std::chrono::steady_clock::time_point started) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+}
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t length) {
+  while (length--) {
+    crc ^= (uint16_t) *data++ << 8;
+    for (int i = 0; i < 8; i++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// the server side: checks each record and keeps the sequence numbers it got
+static std::set<uint32_t> received;
+static uint32_t duplicates = 0, invalid = 0;
+
+static uint16_t server(const sim800_emulator_request_t &request, std::string &) {
+  const uint8_t *p = (const uint8_t *) request.body.data(), *end = p + request.body.size();
+  while (p < end) {
+    if (end - p < 9 || p[0] != 0xA5) {
+      invalid++;
+      return 400;
+    }
+    uint16_t size = p[1] | p[2] << 8;
+    uint32_t seq = p[3] | p[4] << 8 | p[5] << 16 | (uint32_t) p[6] << 24;
+    const uint8_t *trailer = p + 7 + size;
+    if (trailer + 2 > end || crc16(0xffff, p + 1, 6 + size) != (trailer[0] | trailer[1] << 8)) {
+      invalid++;
+      return 400;
+    }
+    if (!received.insert(seq).second) duplicates++;
+    p = trailer + 2;
+  }
+  return 200;
+}
+
+static void test_append(SIM800RAMStorage &storage) {
+  UbirchSIM800Log log(storage);
+  CHECK(log.begin());
+  CHECK_EQUAL(0, log.records());
+
+  char record[RECORD_SIZE];
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  bool ok = true;
+  for (uint32_t i = 0; i < RECORDS; i++) {
+    snprintf(record, sizeof(record), "{\"n\":%u,\"t\":21.5,\"h\":40}", i);
+    ok = log.append(record, sizeof(record)) && ok;
+  }
+  printf("append %d records of %d bytes: %.1f ms\n", RECORDS, RECORD_SIZE, real_ms(started));
+  CHECK(ok);
+  CHECK_EQUAL(RECORDS, log.records());
+  CHECK_EQUAL(RECORDS * (RECORD_SIZE + SIM800_LOG_HEADER + SIM800_LOG_TRAILER), log.bytes());
+
+  // a full log refuses more records
+  UbirchSIM800Log full(storage);
+  CHECK(full.begin());
+  CHECK_EQUAL(RECORDS, full.records());
+  std::string large(100, 'x');
+  CHECK(!full.append(large.data(), large.size()));
+}
+
+static void test_recover(SIM800RAMStorage &storage) {
+  UbirchSIM800Log log(storage);
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  CHECK(log.begin());
+  printf("recover %u records: %.1f ms\n", log.records(), real_ms(started));
+  CHECK_EQUAL(RECORDS, log.records());
+
+  // a record torn by a power loss is not part of the log
+  SIM800RAMStorage torn = storage;
+  UbirchSIM800Log tail(torn);
+  CHECK(tail.begin());
+  tail.append("0123456789", 10);
+  torn.data[2 * SIM800_LOG_CURSOR + log.bytes() + SIM800_LOG_HEADER + 3] ^= 0x55;
+  UbirchSIM800Log recovered(torn);
+  CHECK(recovered.begin());
+  CHECK_EQUAL(RECORDS, recovered.records());
+
+  // streaming the records as they are stored
+  UbirchSIM800LogStream body(log, 0, log.bytes());
+  uint32_t n = 0;
+  started = std::chrono::steady_clock::now();
+  while (body.read() != -1) n++;
+  printf("stream %u bytes: %.1f ms\n", n, real_ms(started));
+  CHECK_EQUAL(log.bytes(), n);
+}
+
+static void test_flush(SIM800RAMStorage &storage) {
+  chip.restart();
+  chip.http = server;
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset() && sim.registerNetwork() && sim.enableGPRS());
+
+  // the power fails after the first request was accepted, but before the cursor is saved
+  UbirchSIM800Log log(storage);
+  CHECK(log.begin());
+  chip.on_command = [&storage](const std::string &command, std::string &) {
+    if (!command.compare(0, 14, "AT+HTTPACTION=")) storage.power = false;
+    return false;
+  };
+  CHECK_EQUAL(0, log.flush(sim, "http://example.com/log"));
+  CHECK_EQUAL(1, chip.requests.size());
+  uint32_t first = (uint32_t) received.size();
+  CHECK(first > 0);
+  chip.on_command = NULL;
+  storage.power = true;
+
+  // after the restart everything is sent, the first request again
+  UbirchSIM800Log restarted(storage);
+  CHECK(restarted.begin());
+  CHECK_EQUAL(RECORDS, restarted.records());
+  double started = sim800_test_ms();
+  CHECK_EQUAL(RECORDS, restarted.flush(sim, "http://example.com/log"));
+  double elapsed = sim800_test_ms() - started;
+  printf("flush %d records in %u requests: %.0f ms (virtual), %.0f records/s\n",
+         RECORDS, (unsigned) chip.requests.size() - 1, elapsed, RECORDS / elapsed * 1000);
+  CHECK_EQUAL(0, restarted.records());
+  CHECK_EQUAL(RECORDS, received.size());
+  CHECK_EQUAL(first, duplicates);
+  CHECK_EQUAL(0, invalid);
+  CHECK(*received.rbegin() == RECORDS - 1);
+
+  // the cursor survives a restart
+  UbirchSIM800Log empty(storage);
+  CHECK(empty.begin());
+  CHECK_EQUAL(0, empty.records());
+  CHECK(empty.append("{}", 2));
+  CHECK_EQUAL(1, empty.flush(sim, "http://example.com/log"));
+  CHECK(*received.rbegin() == RECORDS);
+}
+
+int main() {
+  SIM800RAMStorage storage(2 * SIM800_LOG_CURSOR + RECORDS * (RECORD_SIZE + SIM800_LOG_HEADER + SIM800_LOG_TRAILER) + 100);
+  test_append(storage);
+  test_recover(storage);
+  test_flush(storage);
+  return sim800_test_result();
+}
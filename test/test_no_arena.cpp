@@ -0,0 +1,56 @@
+/**
+ * Streamed transfers without the built-in transfer buffer (SIM800_NO_ARENA):
+ * they fail until the application lends one with setBuffer().
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+#include "UbirchSIM800.h"
+#include "sim800_test.h"
+
+static SIM800Emulator &chip = sim800_emulator();
+
+int main() {
+  chip.restart();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset() && sim.registerNetwork() && sim.enableGPRS());
+  chip.http_body = sim800_test_data(3000);
+  unsigned long length, accepted;
+
+  // nothing is sent to the chip without a buffer
+  SIM800TestStream file;
+  sim800_download_t p = {0, 0, 0};
+  SIM800TestStream body(sim800_test_data(100));
+  CHECK_EQUAL(0, sim.open("example.com", 7));
+  size_t commands = chip.commands;
+  CHECK_EQUAL(1006, sim.HTTP_get("http://example.com/data", length, file));
+  CHECK_EQUAL(1006, sim.HTTP_download("http://example.com/data", p, file));
+  CHECK_EQUAL(1006, sim.HTTP_post("http://example.com/in", length, body, 100));
+  CHECK(!sim.send(0, body, accepted));
+  CHECK_EQUAL(commands, chip.commands);
+
+  std::vector<char> buffer(256);
+  sim.setBuffer(buffer.data(), buffer.size());
+  CHECK_EQUAL(200, sim.HTTP_get("http://example.com/data", length, file));
+  CHECK(file.data == chip.http_body);
+  CHECK_EQUAL(200, sim.HTTP_post("http://example.com/in", length, body, 100));
+  CHECK(chip.requests.back().body == body.data);
+  return sim800_test_result();
+}
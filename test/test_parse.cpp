@@ -0,0 +1,131 @@
+/**
+ * The parsers of the chip responses: clock, battery, IMEI, location and
+ * the network registration.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UbirchSIM800.h"
+#include "sim800_test.h"
+
+static SIM800Emulator &chip = sim800_emulator();
+
+// exposes the URC matcher
+class ParseSIM800 : public UbirchSIM800 {
+public:
+    using UbirchSIM800::is_urc;
+};
+
+static uint8_t creg_status = 0xff;
+static uint16_t creg_lac = 0, creg_ci = 0;
+
+static void registration(uint8_t status, uint16_t lac, uint16_t ci) {
+  creg_status = status;
+  creg_lac = lac;
+  creg_ci = ci;
+}
+
+static void test_registration(UbirchSIM800 &sim) {
+  sim.onRegistration(registration);
+  CHECK(sim.reset());
+  CHECK(sim.registerNetwork());
+  CHECK_EQUAL(1, creg_status);
+  CHECK_EQUAL(0x1A2B, creg_lac);
+  CHECK_EQUAL(0x3C4D, creg_ci);
+}
+
+static void test_time(UbirchSIM800 &sim) {
+  char date[9], time[9], tz[4];
+  CHECK(sim.time(date, time, tz));
+  CHECK(!strcmp(date, "16/04/24"));
+  CHECK(!strcmp(time, "12:34:56"));
+  CHECK(!strcmp(tz, "+08"));
+
+  // west of Greenwich
+  chip.clock = "16/04/24,04:34:56-08";
+  CHECK(sim.time(date, time, tz));
+  CHECK(!strcmp(date, "16/04/24"));
+  CHECK(!strcmp(time, "04:34:56"));
+  CHECK(!strcmp(tz, "-08"));
+}
+
+static void test_battery(UbirchSIM800 &sim) {
+  uint16_t status = 0xffff, percent = 0, voltage = 0;
+  CHECK(sim.battery(status, percent, voltage));
+  CHECK_EQUAL(0, status);
+  CHECK_EQUAL(87, percent);
+  CHECK_EQUAL(4112, voltage);
+}
+
+static void test_imei(UbirchSIM800 &sim) {
+  char imei[16];
+  CHECK(sim.IMEI(imei));
+  CHECK(!strcmp(imei, "869012345678901"));
+}
+
+static void test_location(UbirchSIM800 &sim) {
+  sim800_location_t location;
+  CHECK(sim.enableGPRS());
+  CHECK(sim.location(location));
+  CHECK(!strcmp(location.lon, "13.404954"));
+  CHECK(!strcmp(location.lat, "52.520008"));
+  CHECK(!strcmp(location.date, "2016/04/24"));
+  CHECK(!strcmp(location.time, "12:34:56"));
+}
+
+static void test_numbers(UbirchSIM800 &sim) {
+  uint32_t n = 0, n1 = 0, n2 = 0;
+  sim.println(F("AT+CBC"));
+  CHECK(sim.expect_numbers(F("+CBC: "), n, n1, n2));
+  CHECK_EQUAL(0, n);
+  CHECK_EQUAL(87, n1);
+  CHECK_EQUAL(4112, n2);
+  CHECK(sim.expect_OK());
+
+  // the prefix must match
+  sim.println(F("AT+CBC"));
+  CHECK(!sim.expect_numbers(F("+CSQ: "), n, 100));
+}
+
+// every message of the table is found with its id, lines that only start alike are not
+static void test_urcs() {
+  ParseSIM800 sim;
+#define SIM800_URC_CHECK(id, message) \
+  sim.urc_status = 0xff; \
+  CHECK(sim.is_urc(message "1", sizeof(message))); \
+  CHECK_EQUAL(SIM800_URC_##id, sim.urc_status);
+  SIM800_URCS(SIM800_URC_CHECK)
+#undef SIM800_URC_CHECK
+
+  static const char *const others[] = {"OK", "+CIPSTATUS", "+CSQ: 20,0", "*PSX", "DATA", "UNDER-VOLTAGE", "0, CLOSE OK"};
+  for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++) CHECK(!sim.is_urc(others[i], strlen(others[i])));
+}
+
+int main() {
+  chip.restart();
+  test_urcs();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  test_registration(sim);
+  test_time(sim);
+  test_battery(sim);
+  test_imei(sim);
+  test_location(sim);
+  test_numbers(sim);
+  return sim800_test_result();
+}
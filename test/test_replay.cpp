@@ -0,0 +1,49 @@
+/**
+ * Plays back the session recorded by test_trace, the driver must send
+ * exactly what it sent to the emulator.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+#include "sim800_session.h"
+
+const uint8_t *sim800_replay_trace = NULL;
+size_t sim800_replay_size = 0;
+
+int main() {
+  static std::vector<uint8_t> trace;
+  FILE *in = fopen("session.trace", "rb");
+  CHECK(in != NULL);
+  if (!in) return sim800_test_result();
+  uint8_t block[4096];
+  size_t n;
+  while ((n = fread(block, 1, sizeof(block), in)) > 0) trace.insert(trace.end(), block, block + n);
+  fclose(in);
+
+  // the port is constructed with the driver
+  sim800_replay_trace = trace.data();
+  sim800_replay_size = trace.size();
+  UbirchSIM800 sim;
+  sim800_session(sim);
+
+  CHECK(!sim._serial.diverged());
+  if (sim._serial.diverged()) printf("diverged at byte %u of the trace\n", (unsigned) sim._serial.divergence());
+  CHECK(sim._serial.done());
+  return sim800_test_result();
+}
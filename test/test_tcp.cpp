@@ -0,0 +1,218 @@
+/**
+ * TCP over the multiplexed links and in transparent mode.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UbirchSIM800.h"
+#include "sim800_test.h"
+
+static SIM800Emulator &chip = sim800_emulator();
+
+static std::string receive(UbirchSIM800 &sim, uint8_t link, size_t size) {
+  std::string data;
+  char buffer[2000];
+  unsigned long started = millis();
+  while (data.size() < size && millis() - started < 10000) {
+    data.append(buffer, sim.receive(link, buffer, sizeof(buffer), 2000));
+  }
+  return data;
+}
+
+static void write_pieces(Print &out, void *ctx) {
+  const std::string &data = *(const std::string *) ctx;
+  for (size_t i = 0; i < data.size(); i += 100) out.write((const uint8_t *) data.data() + i, min((size_t) 100, data.size() - i));
+}
+
+// the statistics of a command, all answered if the final result was recognized
+static bool answered(UbirchSIM800 &sim, const char *name) {
+  for (uint8_t i = 0; i < SIM800_STATS_COMMANDS; i++) {
+    const sim800_command_stats_t &c = sim.stats().commands[i];
+    if (!strncmp(c.name, name, SIM800_STATS_NAME)) return c.count && c.answered == c.count;
+  }
+  return false;
+}
+
+// the shortest time a command waited for its final result
+static uint16_t fastest(UbirchSIM800 &sim, const char *name) {
+  for (uint8_t i = 0; i < SIM800_STATS_COMMANDS; i++) {
+    const sim800_command_stats_t &c = sim.stats().commands[i];
+    if (!strncmp(c.name, name, SIM800_STATS_NAME)) return c.min;
+  }
+  return 0;
+}
+
+static void test_links(UbirchSIM800 &sim) {
+  int8_t link = sim.open("example.com", 80);
+  CHECK_EQUAL(0, link);
+  CHECK_EQUAL(1, sim.open("example.org", 8080));
+
+  // a buffer larger than the window
+  std::string data = sim800_test_data(8000);
+  unsigned long accepted = 0;
+  CHECK(sim.send(0, (char *) data.data(), data.size(), accepted));
+  CHECK(accepted >= data.size() - SIM800_SEND_WINDOW);
+  CHECK(sim.send_flush(0));
+  // the peer gets it one network delay later
+  delay(chip.config.network + 10);
+  CHECK(chip.remote[0] == data);
+
+  // a stream on the second link
+  SIM800TestStream file(sim800_test_data(5000, 2));
+  CHECK(sim.send(1, file, accepted));
+  CHECK(sim.send_flush(1));
+  delay(chip.config.network + 10);
+  CHECK(chip.remote[1] == file.data);
+
+  // a writer that produces more than the window in small pieces
+  std::string written = sim800_test_data(8000, 4);
+  CHECK(sim.send(0, write_pieces, &written, accepted));
+  CHECK(sim.send_flush(0));
+  delay(chip.config.network + 10);
+  CHECK(chip.remote[0] == data + written);
+  // accepted counts this call, the link keeps the total
+  CHECK(accepted <= written.size());
+  CHECK_EQUAL(data.size() + written.size(), sim.tx_accepted(0));
+
+  // the link 0 send waits for the chip and reports this call only
+  CHECK(sim.send((char *) "hello", 5, accepted));
+  CHECK_EQUAL(5, accepted);
+  CHECK_EQUAL(data.size() + written.size() + 5, sim.tx_accepted(0));
+
+  unsigned long sent = 0, acked = 0, nacked = 0;
+  CHECK(sim.acknowledged(0, sent, acked, nacked));
+  CHECK_EQUAL(data.size() + written.size() + 5, sent);
+  CHECK_EQUAL(0, nacked);
+
+  // the peer answers, the data notification wakes up receive()
+  std::string answer = sim800_test_data(3000, 3);
+  chip.push(0, answer);
+  CHECK(receive(sim, 0, answer.size()) == answer);
+  CHECK(!sim.available(0));
+
+  // the peer closes the second link, the next open() finds it free again
+  chip.close(1);
+  delay(10);
+  CHECK(!sim.available(1));
+  CHECK_EQUAL(1, sim.open("example.org", 8080));
+
+  // a notification still on the wire when a command is sent is not lost
+  uint16_t bat_status, bat_percent, bat_voltage;
+  chip.urc("+CIPRXGET: 1,0");
+  CHECK(sim.battery(bat_status, bat_percent, bat_voltage));
+  CHECK(sim.available(0));
+
+  // links out of range are refused before anything is sent
+  size_t commands = chip.commands;
+  char byte = 'x';
+  SIM800TestStream stream("x");
+  CHECK(!sim.send(SIM800_LINKS, &byte, 1, accepted));
+  CHECK(!sim.send(SIM800_LINKS, stream, accepted));
+  CHECK(!sim.send(SIM800_LINKS, write_pieces, &written, accepted));
+  CHECK(!sim.send_flush(SIM800_LINKS));
+  CHECK(!sim.acknowledged(255, sent, acked, nacked));
+  CHECK(!sim.available(SIM800_LINKS));
+  CHECK_EQUAL(0, sim.receive(SIM800_LINKS, &byte, 1));
+  CHECK(!sim.disconnect(SIM800_LINKS));
+  CHECK(!sim.status(SIM800_LINKS));
+  CHECK_EQUAL(0, sim.tx_accepted(SIM800_LINKS));
+  CHECK_EQUAL(commands, chip.commands);
+
+  // the bare IP address and "<n>, CLOSE OK" are final results
+  CHECK(answered(sim, "+CIFSR"));
+  sim.resetStats();
+  CHECK(sim.disconnect(0));
+  CHECK(sim.disconnect(1));
+  CHECK(answered(sim, "+CIPCLOSE"));
+  CHECK(!sim.status(0));
+
+  // a URC before the answer does not end the command
+  uint32_t latency = chip.config.latency;
+  chip.config.latency = 50;
+  chip.urc("DATA ACCEPT:0,0");
+  CHECK(sim.battery(bat_status, bat_percent, bat_voltage));
+  CHECK(answered(sim, "+CBC"));
+  CHECK(fastest(sim, "+CBC") >= 50);
+  chip.config.latency = latency;
+}
+
+static void test_transparent(UbirchSIM800 &sim) {
+  Stream *socket = sim.connectTransparent("example.com", 7);
+  CHECK(socket != NULL);
+  if (!socket) return;
+
+  socket->print("hello");
+  delay(chip.config.network + 10);
+  CHECK(chip.remote[0] == "hello");
+
+  // the driver keeps its hands off the socket data
+  chip.push(0, "world");
+  delay(chip.config.network + 10);
+  CHECK(!sim.poll());
+  CHECK(!sim.available(0));
+  CHECK(!sim.queue_AT(F("")));
+  sim.println(F("AT"));
+  delay(chip.config.network + 10);
+  CHECK(chip.remote[0] == "hello");
+
+  std::string answer;
+  unsigned long started = millis();
+  while (answer.size() < 5 && millis() - started < 2000) {
+    int c = socket->read();
+    if (c != -1) answer += (char) c;
+  }
+  CHECK(answer == "world");
+
+  CHECK(sim.disconnectTransparent());
+  CHECK(chip.remote[0] == "hello");
+  CHECK(sim.expect_AT_OK(F("")));
+}
+
+static void test_lost_state() {
+  // a second connection finds the IP stack up, but the chip does not tell its state
+  chip.restart();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset());
+  CHECK(sim.registerNetwork());
+  CHECK_EQUAL(0, sim.open("example.com", 80));
+
+  UbirchSIM800 other;
+  other.setAPN(F("internet"), NULL, NULL);
+  chip.on_command = [](const std::string &command, std::string &reply) {
+    if (command != "AT+CIPSTATUS") return false;
+    reply = "\r\nOK\r\n";
+    return true;
+  };
+  double started = sim800_test_ms();
+  CHECK_EQUAL(-1, other.open("example.com", 80));
+  CHECK(sim800_test_ms() - started < 3 * SIM800_SERIAL_TIMEOUT);
+  chip.on_command = NULL;
+}
+
+int main() {
+  chip.restart();
+  UbirchSIM800 sim;
+  sim.setAPN(F("internet"), NULL, NULL);
+  CHECK(sim.reset());
+  CHECK(sim.registerNetwork());
+  test_links(sim);
+  test_transparent(sim);
+  test_lost_state();
+  return sim800_test_result();
+}
@@ -0,0 +1,50 @@
+/**
+ * Records a session with the emulator into session.trace for
+ * test_replay and tools/sim800_trace.py.
+ *
+ * @author Matthias L. Jugel
+ *
+ * Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+ *
+ * == LICENSE ==
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim800_session.h"
+
+static SIM800Emulator &chip = sim800_emulator();
+
+int main() {
+  chip.restart();
+  chip.http_body = sim800_test_data(2000);
+  // the peer echoes
+  chip.on_data = [](uint8_t link, const std::string &data) { sim800_emulator().push(link, data); };
+
+  UbirchSIM800 sim;
+  sim800_session(sim);
+
+  SIM800TestStream trace;
+  sim.dumpTrace(trace);
+  CHECK(trace.data.compare(0, 8, SIM800_TRACE_MAGIC) == 0);
+  // the ring did not overflow, the recording starts with the reset
+  CHECK(trace.data.size() > 8 && trace.data[8] == SIM800_TRACE_BAUD);
+
+  FILE *out = fopen("session.trace", "wb");
+  CHECK(out != NULL);
+  if (out) {
+    CHECK_EQUAL(trace.data.size(), fwrite(trace.data.data(), 1, trace.data.size(), out));
+    fclose(out);
+  }
+  printf("recorded %u bytes\n", (unsigned) trace.data.size());
+  return sim800_test_result();
+}
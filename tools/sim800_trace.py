@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""
+Decode a serial trace written by UbirchSIM800::dumpTrace() (compile with -DSIM800_TRACE=<bytes>).
+
+Prints the timeline of the session and how long each AT command waited for its final
+result, or writes the trace as a C array to replay it with UbirchSIM800Replay on the host.
+
+  sim800_trace.py trace.bin               timeline and command latencies
+  sim800_trace.py --summary trace.bin     command latencies only
+  sim800_trace.py --c-array trace.bin     C array for UbirchSIM800Replay
+
+@author Matthias L. Jugel
+
+Copyright 2015 ubirch GmbH (http://www.ubirch.com)
+
+== LICENSE ==
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+MAGIC = b"SIM800TR"
+HEADER = 4
+TYPES = {ord('T'): "TX", ord('R'): "RX", ord('B'): "BAUD"}
+
+# the driver header, it has the final result codes that end a command
+HEADER_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "UbirchSIM800.h")
+
+
+def final_results(header):
+    """the regular expression for SIM800_FINAL_RESULTS in the header, the same results the driver uses"""
+    with open(header) as f:
+        table = re.search(r"#define SIM800_FINAL_RESULTS\(RESULT, PREFIX\)((?:.*\\\n)*.*)", f.read())
+    if not table:
+        raise ValueError("%s: SIM800_FINAL_RESULTS not found" % header)
+    results = [re.escape(text.strip()) + (".*" if kind == "PREFIX" else "")
+               for kind, text in re.findall(r'(RESULT|PREFIX)\("([^"]*)"\)', table.group(1))]
+    return re.compile(r"^(\d, ?)?(%s)$|^\d+\.\d+\.\d+\.\d+$" % "|".join(results), re.ASCII)
+
+
+def records(data):
+    """yield (ms since the start, type, payload) for each record of the trace"""
+    if data.startswith(MAGIC):
+        data = data[len(MAGIC):]
+    pos, time = 0, 0
+    while pos + HEADER <= len(data):
+        kind, delta, size = struct.unpack_from("<BHB", data, pos)
+        payload = data[pos + HEADER:pos + HEADER + size]
+        pos += HEADER + size
+        time += delta
+        if kind not in TYPES:
+            raise ValueError("unknown record type 0x%02x at offset %d" % (kind, pos - HEADER - size))
+        yield time, TYPES[kind], payload
+
+
+def lines(data):
+    """join the records to lines: (ms of the first byte, direction, line)"""
+    pending = {"TX": (0, b""), "RX": (0, b"")}
+    for time, kind, payload in records(data):
+        if kind == "BAUD":
+            yield time, kind, b"%d" % struct.unpack("<I", payload)[0]
+            continue
+        start, line = pending[kind]
+        if not line:
+            start = time
+        for c in payload:
+            line += bytes([c])
+            # the data prompt has no line end
+            if line.endswith(b"\n") or (kind == "RX" and line.strip() == b">"):
+                if line.strip():
+                    yield start, kind, line.strip(b"\r\n")
+                start, line = time, b""
+        pending[kind] = (start, line)
+    for kind, (start, line) in pending.items():
+        if line.strip():
+            yield start, kind, line.strip(b"\r\n")
+
+
+def printable(line):
+    return "".join(chr(c) if 32 <= c < 127 else "\\x%02x" % c for c in line)
+
+
+def timeline(data, out):
+    for time, kind, line in lines(data):
+        out.write("%+9d ms %-4s %s\n" % (time, kind, printable(line)))
+
+
+def latencies(data, final):
+    """yield (command, ms until the final result, result) for each AT command"""
+    command = None
+    for time, kind, line in lines(data):
+        if kind == "TX" and line.upper().startswith(b"AT"):
+            command = (time, line)
+        elif kind == "RX" and command and final.match(line.strip().decode("latin-1")):
+            yield command[1], time - command[0], line.strip()
+            command = None
+    if command:
+        yield command[1], None, b"(no result)"
+
+
+def summary(data, out, final):
+    stats = {}
+    for command, ms, result in latencies(data, final):
+        name = re.match(rb"AT([+&]?[A-Z]*)", command.upper()).group(1) or b"AT"
+        entry = stats.setdefault(name, [0, 0, None, None, 0])
+        entry[0] += 1
+        if ms is None:
+            entry[4] += 1
+            continue
+        entry[1] += ms
+        entry[2] = ms if entry[2] is None else min(entry[2], ms)
+        entry[3] = ms if entry[3] is None else max(entry[3], ms)
+
+    out.write("%-12s %6s %8s %8s %8s %8s\n" % ("command", "count", "min", "avg", "max", "open"))
+    for name, (count, total, low, high, missing) in sorted(stats.items(), key=lambda e: -e[1][1]):
+        answered = count - missing
+        out.write("%-12s %6d %8s %8s %8s %8d\n" % (
+            name.decode("ascii", "replace"), count,
+            "-" if low is None else low,
+            "-" if not answered else total // answered,
+            "-" if high is None else high, missing))
+
+
+def c_array(data, out, name):
+    out.write("// recorded with UbirchSIM800::dumpTrace(), replay with UbirchSIM800Replay(%s, sizeof(%s))\n"
+              % (name, name))
+    out.write("const uint8_t %s[] = {\n" % name)
+    for i in range(0, len(data), 16):
+        out.write("  " + ", ".join("0x%02x" % c for c in data[i:i + 16]) + ",\n")
+    out.write("};\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="decode a SIM800 serial trace")
+    parser.add_argument("trace", help="binary trace as written by dumpTrace()")
+    parser.add_argument("--summary", action="store_true", help="only print the command latencies")
+    parser.add_argument("--c-array", metavar="NAME", nargs="?", const="sim800_trace",
+                        help="write the trace as a C array for UbirchSIM800Replay")
+    parser.add_argument("--header", default=HEADER_FILE,
+                        help="driver header with the final result codes (default: %(default)s)")
+    args = parser.parse_args()
+
+    with open(args.trace, "rb") as f:
+        data = f.read()
+    start = data.find(MAGIC)
+    if start < 0:
+        sys.exit("%s: no trace found" % args.trace)
+    data = data[start:]
+
+    if args.c_array:
+        c_array(data, sys.stdout, args.c_array)
+        return
+    if not args.summary:
+        timeline(data, sys.stdout)
+        sys.stdout.write("\n")
+    summary(data, sys.stdout, final_results(args.header))
+
+
+if __name__ == "__main__":
+    main()